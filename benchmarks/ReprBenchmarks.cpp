@@ -0,0 +1,307 @@
+#define ENABLE_REPR_LLVM
+#include <repr.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <benchmark/benchmark.h>
+
+#include "test_config.h"
+
+// Every call to the global operator new is counted, so that the benchmarks
+// can report how many heap allocations a single repr() call makes.
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size != 0 ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+// not inlined, so that the compiler doesn't see free() paired with new
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/**
+ * Renders `x` in a loop and reports the output throughput, `elements` per
+ * call as the item throughput and the number of heap allocations per call.
+ * The output string is reused and grown before measuring, so only the
+ * allocations made by repr itself are counted.
+ */
+template <typename T>
+static void renderLoop(benchmark::State& state, const T& x,
+                       std::size_t elements,
+                       const repr_options& options = repr_options())
+{
+    std::string out;
+    repr_into(out, x, options);
+    std::size_t bytes = 0;
+    std::size_t before = allocations.load(std::memory_order_relaxed);
+
+    for (auto _ : state) {
+        out.clear();
+        repr_into(out, x, options);
+        benchmark::DoNotOptimize(out.data());
+        bytes += out.size();
+    }
+
+    std::size_t allocs = allocations.load(std::memory_order_relaxed) - before;
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(elements * state.iterations());
+    state.counters["allocs"] = benchmark::Counter(
+        static_cast<double>(allocs), benchmark::Counter::kAvgIterations);
+}
+
+static void BM_IntVector(benchmark::State& state)
+{
+    std::vector<int> xs;
+    for (int i = 0; i < state.range(0); ++i)
+        xs.push_back(i * 7919 - 1000000);
+    renderLoop(state, xs, xs.size());
+}
+BENCHMARK(BM_IntVector)->Range(8, 1 << 16);
+
+static void BM_DoubleVector(benchmark::State& state)
+{
+    std::vector<double> xs;
+    for (int i = 0; i < state.range(0); ++i)
+        xs.push_back(i / 7.0);
+    renderLoop(state, xs, xs.size());
+}
+BENCHMARK(BM_DoubleVector)->Range(8, 1 << 16);
+
+typedef std::map<std::string, std::map<std::string, std::string>> StringMap;
+
+static StringMap nestedStringMap(int size, std::size_t& elements)
+{
+    StringMap xs;
+    elements = 0;
+    for (int i = 0; i < size; ++i) {
+        auto& inner = xs["key" + std::to_string(i)];
+        for (int j = 0; j < 8; ++j, ++elements)
+            inner["field" + std::to_string(j)] = "value " + std::to_string(i);
+    }
+    return xs;
+}
+
+static void BM_NestedStringMap(benchmark::State& state)
+{
+    std::size_t elements;
+    StringMap xs = nestedStringMap(state.range(0), elements);
+    renderLoop(state, xs, elements);
+}
+BENCHMARK(BM_NestedStringMap)->Range(8, 1 << 12);
+
+// the same map, copied from a repr_render_cache after the first call
+static void BM_CachedStringMap(benchmark::State& state)
+{
+    std::size_t elements;
+    StringMap xs = nestedStringMap(state.range(0), elements);
+
+    repr_render_cache cache(std::size_t(1) << 30);
+    repr_options options;
+    options.render_cache = &cache;
+    renderLoop(state, repr_cached(xs), elements, options);
+}
+BENCHMARK(BM_CachedStringMap)->Range(8, 1 << 12);
+
+static void BM_Tuples(benchmark::State& state)
+{
+    std::vector<std::tuple<int, std::string, double>> xs;
+    for (int i = 0; i < state.range(0); ++i)
+        xs.push_back(std::make_tuple(i, "name" + std::to_string(i), i * 0.5));
+    renderLoop(state, xs, xs.size());
+}
+BENCHMARK(BM_Tuples)->Range(8, 1 << 14);
+
+// the second argument selects the escaping, as in repr_escape
+static void BM_CharBuffer(benchmark::State& state)
+{
+    std::vector<char> xs;
+    for (int i = 0; i < state.range(0); ++i)
+        xs.push_back(i % 61 == 60 ? '\n' : static_cast<char>('a' + i % 26));
+
+    repr_options options;
+    options.escape = static_cast<repr_escape>(state.range(1));
+    renderLoop(state, xs, xs.size(), options);
+}
+BENCHMARK(BM_CharBuffer)
+    ->Ranges({{64, 1 << 20},
+              {static_cast<int>(repr_escape::raw),
+               static_cast<int>(repr_escape::c)}});
+
+// every vector is pointed to four times; the second argument enables
+// repr_options::track_pointers
+static void BM_SharedPtrGraph(benchmark::State& state)
+{
+    std::vector<std::shared_ptr<std::vector<int>>> nodes;
+    for (int i = 0; i < state.range(0); ++i)
+        nodes.push_back(std::make_shared<std::vector<int>>(4, i));
+
+    std::vector<std::shared_ptr<std::vector<int>>> xs;
+    for (int i = 0; i < 4; ++i)
+        xs.insert(xs.end(), nodes.begin(), nodes.end());
+
+    repr_options options;
+    options.track_pointers = state.range(1) != 0;
+    renderLoop(state, xs, xs.size(), options);
+}
+BENCHMARK(BM_SharedPtrGraph)->Ranges({{8, 1 << 12}, {0, 1}});
+
+static std::unique_ptr<llvm::Module> parseAssembly(const std::string& assembly,
+                                                   llvm::LLVMContext& context)
+{
+    llvm::SMDiagnostic error;
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 5
+    std::unique_ptr<llvm::Module> module(new llvm::Module("Module", context));
+    if (!llvm::ParseAssemblyString(assembly.c_str(), module.get(), error,
+                                   context))
+        module.reset();
+    return module;
+#else
+    return llvm::parseAssemblyString(assembly, error, context);
+#endif
+}
+
+static std::unique_ptr<llvm::Module> getTestModule(const std::string& name,
+                                                   llvm::LLVMContext& context)
+{
+    llvm::SMDiagnostic error;
+    std::ostringstream osstr;
+    osstr << TEST_DATA_DIR << "/" << name << "-" << LLVM_VERSION_MAJOR << "."
+          << LLVM_VERSION_MINOR << ".ll";
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 5
+    return std::unique_ptr<llvm::Module>(
+        llvm::ParseAssemblyFile(osstr.str(), error, context));
+#else
+    return llvm::parseAssemblyFile(osstr.str(), error, context);
+#endif
+}
+
+/**
+ * Generates a module with `functions` functions, each a chain of `blocks`
+ * basic blocks holding `insts` unnamed instructions.
+ */
+static std::string syntheticModule(int functions, int blocks, int insts)
+{
+    std::ostringstream src;
+    for (int f = 0; f < functions; ++f) {
+        src << "define i32 @f" << f << "(i32 %a) {\n";
+        int value = 0;
+        for (int b = 0; b < blocks; ++b) {
+            src << "b" << b << ":\n";
+            for (int i = 0; i < insts; ++i, ++value) {
+                src << "  %" << value << " = add i32 ";
+                if (value == 0)
+                    src << "%a";
+                else
+                    src << "%" << value - 1;
+                src << ", " << i << "\n";
+            }
+            if (b + 1 < blocks)
+                src << "  br label %b" << b + 1 << "\n";
+            else
+                src << "  ret i32 %" << value - 1 << "\n";
+        }
+        src << "}\n";
+    }
+    return src.str();
+}
+
+// the instruction lists of all basic blocks of a module
+typedef std::vector<const llvm::BasicBlock::InstListType*> InstLists;
+
+static InstLists instLists(llvm::Module& module, std::size_t& count)
+{
+    InstLists insts;
+    count = 0;
+    for (auto& func : module) {
+        for (auto& bb : func) {
+            insts.push_back(&bb.getInstList());
+            count += bb.size();
+        }
+    }
+    return insts;
+}
+
+// renders all instructions of a module, optionally with a
+// repr_options::llvm_session
+static void renderModule(benchmark::State& state, llvm::Module& module,
+                         bool session)
+{
+    std::size_t count;
+    InstLists insts = instLists(module, count);
+
+    repr_llvm_session llvm_session;
+    repr_options options;
+    if (session)
+        options.llvm_session = &llvm_session;
+    renderLoop(state, insts, count, options);
+}
+
+// the argument enables repr_options::llvm_session
+static void BM_LLVMFixture(benchmark::State& state, const char* name)
+{
+    llvm::LLVMContext context;
+    auto module = getTestModule(name, context);
+    if (!module) {
+        state.SkipWithError("no fixture for this LLVM version");
+        return;
+    }
+    renderModule(state, *module, state.range(0) != 0);
+}
+BENCHMARK_CAPTURE(BM_LLVMFixture, debug_ssa, "debug_ssa")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_LLVMFixture, debug_unopt, "debug_unopt")->Arg(0)->Arg(1);
+
+// functions of 256 instructions each, the second argument enables
+// repr_options::llvm_session
+static void BM_LLVMSynthetic(benchmark::State& state)
+{
+    llvm::LLVMContext context;
+    auto module =
+        parseAssembly(syntheticModule(state.range(0), 16, 16), context);
+    if (!module) {
+        state.SkipWithError("cannot parse the generated module");
+        return;
+    }
+    renderModule(state, *module, state.range(1) != 0);
+}
+BENCHMARK(BM_LLVMSynthetic)->Ranges({{1, 64}, {0, 1}});
+
+// renders the module itself, i.e. the names of its functions
+static void BM_LLVMModuleFunctions(benchmark::State& state)
+{
+    llvm::LLVMContext context;
+    auto module = parseAssembly(syntheticModule(state.range(0), 1, 1), context);
+    if (!module) {
+        state.SkipWithError("cannot parse the generated module");
+        return;
+    }
+    renderLoop(state, *module, module->size());
+}
+BENCHMARK(BM_LLVMModuleFunctions)->Range(8, 1 << 12);
+
+BENCHMARK_MAIN();
@@ -10,10 +10,55 @@
 
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <tuple>
+#include <array>
+#include <utility>
+#include <memory>
 #include <type_traits>
 #include <algorithm>
-#include <functional>
 #include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+#include <limits>
+#include <iterator>
+#include <unordered_map>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <new>
+
+#if __cplusplus >= 201703L
+#define REPR_STRING_VIEW 1
+#include <string_view>
+#endif
+
+#ifdef ENABLE_REPR_STATS
+#include <chrono>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define REPR_POSIX_IO 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 // automatically enable LLVM support if llvm-c/Core.h was included
 #ifdef LLVM_C_CORE_H
@@ -30,420 +75,5953 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/DebugLoc.h>
-#endif
-
-// forward declaration
-namespace repr_impl
-{
-template <typename T> void repr_stream(std::ostream&, const T&);
-} // namespace repr_impl
+#include <llvm/IR/Module.h>
 
-template <typename T> std::string repr(const T& x)
-{
-    std::ostringstream out;
-    repr_impl::repr_stream(out, x);
+#if LLVM_VERSION_MAJOR > 3 || LLVM_VERSION_MINOR >= 8
+#define REPR_LLVM_SLOT_TRACKER 1
+#include <llvm/IR/ModuleSlotTracker.h>
+#endif
+#endif
 
-    auto not_space = std::not1(std::ptr_fun<int, int>(std::isspace));
-    std::string result = out.str();
-    result.erase(result.begin(),
-                 std::find_if(result.begin(), result.end(), not_space));
-    result.erase(std::find_if(result.rbegin(), result.rend(), not_space).base(),
-                 result.end());
+class repr_render_cache;
 
-    return result;
-}
+#ifdef ENABLE_REPR_LLVM
+class repr_llvm_session;
+#endif
 
-namespace repr_impl
-{
-using std::enable_if;
-using std::is_function;
-using std::is_same;
-using std::remove_cv;
-using std::remove_extent;
-using std::remove_reference;
+/// How quotes, backslashes and control characters in strings are written.
+enum class repr_escape {
+    raw,  ///< as they are
+    c,    ///< as C escape sequences (`\n`, `\"`, `\033`, ...)
+    json, ///< as JSON escape sequences (`\n`, `\"`, `\u001b`, ...)
+};
 
-#ifdef ENABLE_REPR_LLVM
-struct debug_info {
-    std::string name = "";
-    std::string file = "";
-    int line_number = -1;
-    int column_number = -1;
+/// How containers of bytes (`unsigned char`) are written.
+enum class repr_byte_format {
+    hex, ///< as a string of hex digits, `x"48690a"`
+    dump ///< as lines of offset, hex digits and text, like `hexdump -C`
 };
 
-inline void find_debug_info(const llvm::Value& val, debug_info* dinfo)
-{
-    using namespace llvm;
-    auto* instr_ptr = dyn_cast<Instruction>(&val);
+/// Options controlling the output of `repr()` and `repr_into()`.
+struct repr_options {
+    /**
+     * Number of significant digits to print floating-point numbers with, in
+     * the style of `%g`. By default (0) the shortest representation that
+     * reads back as the same value is used.
+     */
+    int float_precision = 0;
 
-#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6
-    MDNode* mdata = instr_ptr ? instr_ptr->getMetadata("dbg") : nullptr;
+    /**
+     * How many levels of nested containers and tuples to render; deeper ones
+     * are shown as `...`. 0 means no limit.
+     */
+    std::size_t max_depth = 0;
 
-#if LLVM_VERSION_MINOR == 6
-    DILocation diloc_val(mdata);
-    DILocation* dloc = &diloc_val;
-#else
-    DILocation* dloc = dyn_cast_or_null<DILocation>(mdata);
-#endif
+    /**
+     * How many elements of each container, tuple or string to render. The
+     * rest is shown as `<N more>`, or `...` if the size isn't known without
+     * going over all elements. 0 means no limit.
+     */
+    std::size_t max_elements = 0;
 
-    if (dloc) {
-#if LLVM_VERSION_MINOR == 6
-        dinfo->line_number = dloc->getLineNumber();
-        dinfo->column_number = dloc->getColumnNumber();
-        DIScope discope_val(dloc->getScope());
-        DIScope* discope = &discope_val;
-#else
-        dinfo->line_number = dloc->getLine();
-        dinfo->column_number = dloc->getColumn();
-        DIScope* discope = dyn_cast_or_null<DIScope>(dloc->getScope());
-#endif
+    /**
+     * When a random-access container has more than `max_elements` elements,
+     * also render this many elements from its end, after the `<N more>`.
+     */
+    std::size_t tail_elements = 0;
 
-        if (discope != nullptr) {
-            std::string fname = discope->getFilename().str();
-            if (fname.size() > 0)
-                dinfo->file = std::move(fname);
-        }
-    }
-#endif
+    /**
+     * Stop rendering after this many bytes, ending the output with `...` (the
+     * whole output including the `...` is at most this long). 0 means no
+     * limit.
+     */
+    std::size_t max_bytes = 0;
 
-    // to find the variable name try to locate a call to llvm.dbg.value in the
-    // same BB with this value as argument
-    if (instr_ptr != nullptr) {
-        auto* bb = instr_ptr->getParent();
-        for (auto& other_instr : *bb) {
-            if (auto* as_call = dyn_cast<CallInst>(&other_instr)) {
-                auto* func = as_call->getCalledFunction();
-
-                if (func == nullptr ||
-                    func->getName().str() != "llvm.dbg.value")
-                    continue;
+    /**
+     * Keep track of the objects reached through pointers (and iterators), so
+     * that each one is rendered only once. Later occurrences are shown as
+     * `<ref#N>`, where N counts the distinct objects from 1 in the order they
+     * first appear, and pointers back to an object that is still being
+     * rendered as `<cycle>`. Neither contains a space or comma, so they never
+     * need bracketing as elements.
+     */
+    bool track_pointers = false;
 
-                std::string name;
+    /**
+     * Escaping of strings and containers of chars, so that the quotes around
+     * them can be found reliably in the output.
+     */
+    repr_escape escape = repr_escape::raw;
 
-#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR <= 5
-                // LLVM <= 3.5 has metadata within the same hierarchy as Values
-                MDNode* var = dyn_cast<MDNode>(as_call->getOperand(0));
-                if (var->getOperand(0) != instr_ptr)
-                    continue;
+    /**
+     * Format of byte buffers such as `std::vector<std::uint8_t>`; their
+     * `max_elements` counts bytes.
+     */
+    repr_byte_format byte_format = repr_byte_format::hex;
 
-                DIVariable divar(dyn_cast<MDNode>(as_call->getOperand(2)));
-                name = divar.getName().str();
-#else
-                auto* meta0 = dyn_cast<MetadataAsValue>(as_call->getOperand(0))
-                                  ->getMetadata();
+    /**
+     * Write JSON: containers and tuples as arrays, maps with string-like keys
+     * as objects (other maps as arrays of `[key, value]` pairs) and `nullptr`
+     * as `null`. Anything without a JSON form of its own becomes a string of
+     * its text, and strings are escaped JSON-style whatever `escape` says.
+     * Elided parts are shown as strings too, e.g. `"<N more>"`; output cut
+     * short by `max_bytes` isn't valid JSON.
+     */
+    bool json = false;
 
-                if (meta0) {
-                    auto* as_vam = dyn_cast<ValueAsMetadata>(meta0);
-                    if (as_vam && as_vam->getValue() != instr_ptr)
-                        continue;
-                }
+    /**
+     * Lay the output out on lines of at most this many characters where
+     * possible: containers, maps and tuples that don't fit on the rest of the
+     * line get one element per line. 0 means writing everything on one line.
+     */
+    std::size_t line_width = 0;
 
-                auto* meta2 = dyn_cast<MetadataAsValue>(as_call->getOperand(2))
-                                  ->getMetadata();
+    /// Indentation of the elements on their own lines; see `line_width`.
+    std::size_t indent_width = 4;
 
-#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 6
-                DIVariable divar(dyn_cast<MDNode>(meta2));
-                name = divar.getName().str();
-#else
-                // from LLVM 3.7 onwards DIVariable inherits from MDNode
-                auto* divar = dyn_cast_or_null<DIVariable>(meta2);
-                if (divar)
-                    name = divar->getName().str();
-#endif
+    /**
+     * Cache of the text of values wrapped in `repr_cached()`, or nullptr to
+     * render them every time. See `repr_render_cache`.
+     */
+    repr_render_cache* render_cache = nullptr;
+
+#ifdef ENABLE_REPR_LLVM
+    /**
+     * Session whose caches are used for rendering LLVM values, or nullptr to
+     * look everything up for each value. See `repr_llvm_session`.
+     */
+    repr_llvm_session* llvm_session = nullptr;
 #endif
+};
 
-                if (name.size() > 0)
-                    dinfo->name = std::move(name);
-            }
-        }
-    }
+namespace repr_impl
+{
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
 }
 
-// Will print `(<name>@?<filename>:?<line_number>?)` depending on what
-// information is available, or do nothing if nothing is known.
-inline void repr_debug_loc(std::ostream& out, const llvm::Value& val)
+/**
+ * Destination for rendered text.
+ *
+ * Bytes are copied into the window `[pos_, end_)` for as long as they fit.
+ * When the window is full the derived class decides what to do with the rest:
+ * grow the underlying storage, flush it somewhere, or drop it.
+ */
+class output
 {
-    using namespace llvm;
-    debug_info dinfo;
-
-    if (auto bb_ptr = dyn_cast<BasicBlock>(&val)) {
-        // find the first instruction with debug info
-        for (auto& inst : *bb_ptr) {
-            find_debug_info(inst, &dinfo);
-            if (dinfo.line_number > 0)
-                break;
-        }
+  public:
+    void append(const char* data, std::size_t size)
+    {
+        if (size <= static_cast<std::size_t>(end_ - pos_))
+            pos_ = std::copy(data, data + size, pos_);
+        else
+            overflow(data, size);
+    }
 
-        // the name found is not the name of the basic block
-        dinfo.name = "";
-    } else {
-        find_debug_info(val, &dinfo);
+    void push_back(char c)
+    {
+        if (pos_ != end_)
+            *pos_++ = c;
+        else
+            overflow(&c, 1);
     }
 
-    bool has_name = dinfo.name.size() > 0;
-    bool has_file = dinfo.file.size() > 0;
-    bool has_line_number = dinfo.line_number > 0;
-    std::string delayed_out = "";
+    /**
+     * Whether further output makes no difference.
+     *
+     * Overloads looping over elements stop early once this is set.
+     */
+    bool done() const { return done_; }
 
-    if (!has_name && !has_file && !has_line_number)
-        return;
+  protected:
+    output() {}
+    ~output() {}
 
-    out << "(";
+    /// Called with data that does not fit into the current window.
+    virtual void overflow(const char* data, std::size_t size) = 0;
 
-    if (has_name) {
-        out << dinfo.name;
-        delayed_out = "@";
+    char* pos_ = nullptr;
+    char* end_ = nullptr;
+    bool done_ = false;
+};
+
+/**
+ * Output appending to an `std::string`, growing it geometrically.
+ *
+ * The string is resized ahead of the data and has to be trimmed back to the
+ * bytes actually written with `finish()`.
+ */
+class string_output : public output
+{
+  public:
+    explicit string_output(std::string* str) : str_(str), size_(str->size())
+    {
     }
 
-    if (has_file) {
-        out << delayed_out << dinfo.file;
-        delayed_out = ":";
+    ~string_output() { finish(); }
+
+    /// Number of bytes in the string, including ones that were there before.
+    std::size_t size() const
+    {
+        return pos_ ? static_cast<std::size_t>(pos_ - &(*str_)[0]) : size_;
+    }
+
+    void finish()
+    {
+        size_ = size();
+        str_->resize(size_);
+        pos_ = end_ = nullptr;
     }
 
-    if (has_line_number)
-        out << delayed_out << dinfo.line_number;
+  protected:
+    void overflow(const char* data, std::size_t size) override
+    {
+        std::size_t used = this->size();
+        std::size_t capacity = std::max<std::size_t>(2 * used, 64);
+        str_->resize(std::max(capacity, used + size));
 
-    out << ")";
-}
+        pos_ = std::copy(data, data + size, &(*str_)[used]);
+        end_ = &(*str_)[0] + str_->size();
+    }
+
+  private:
+    std::string* str_;
+    std::size_t size_;
+};
+
+#ifdef ENABLE_REPR_STATS
+class stats_scope;
+
+/// Running totals of the calling thread, taken apart by `stats_scope`.
+struct thread_stats {
+    std::uint64_t bytes = 0;
+    std::uint64_t scratch_growths = 0;
+    std::size_t depth = 0;
+    stats_scope* scope = nullptr;
+
+    static thread_stats& local()
+    {
+        static thread_local thread_stats stats;
+        return stats;
+    }
+};
 #endif
 
 /**
- * Dummy struct used to resolve ambiguous function overloads.
- *
- * If `overload_priority<0>()` is passed as an argument to a function, the
- * overloads with a formal argument of type `overload_priority<n>` will be
- * preferred for the smallest `n`. This helps to reduce guards in SFINAE-like
- * template hacks.
+ * Buffers of type `Buffer` which are kept for reuse, so that rendering doesn't
+ * allocate scratch memory again each time.
  */
-template <int n> struct overload_priority : public overload_priority<n + 1> {
-};
+template <typename Buffer> class buffer_pool
+{
+  public:
+    Buffer take()
+    {
+        if (free_.empty())
+            return Buffer();
 
-template <> struct overload_priority<100> {
-};
+        Buffer result = std::move(free_.back());
+        free_.pop_back();
+        kept_ -= bytes(result);
+        return result;
+    }
+
+    /// Keep `buf` for reuse, unless that would exceed `limit` bytes kept.
+    void give(Buffer&& buf, std::size_t limit)
+    {
+        buf.clear();
+
+        if (kept_ + bytes(buf) > limit)
+            return;
+
+        kept_ += bytes(buf);
+        free_.push_back(std::move(buf));
+    }
+
+    void release()
+    {
+        std::vector<Buffer>().swap(free_);
+        kept_ = 0;
+    }
 
-template <typename T, int n> struct tuple_repr {
-    void operator()(const T& tuple, std::vector<std::string>* out)
+  private:
+    static std::size_t bytes(const Buffer& buf)
     {
-        tuple_repr<T, n - 1>()(tuple, out);
-        out->push_back(repr(std::get<n - 1>(tuple)));
+        return buf.capacity() * sizeof(typename Buffer::value_type);
     }
+
+    std::vector<Buffer> free_;
+    std::size_t kept_ = 0;
 };
 
-template <typename T> struct tuple_repr<T, 0> {
-    void operator()(const T&, std::vector<std::string>*) {}
+/// Group of tokens of a `line_layout`, e.g. a container.
+struct layout_group {
+    enum state_t { undecided, broken };
+
+    state_t state;
+    std::size_t indent;   // of the elements, if broken
+    std::size_t flat_pos; // of the start of the group
+    std::size_t token;    // index of its begin token
 };
 
-/**
- * Trait for testing whether a type is a C-style string or std::string.
- */
-template <typename T> struct is_string_like {
-    static const bool value =
-        is_same<T, char*>::value || is_same<T, const char*>::value ||
-        is_same<typename remove_extent<T>::type, char>::value ||
-        is_same<typename remove_extent<T>::type, const char>::value ||
-        is_same<T, std::string>::value;
+/// Piece of text or place to break the line at, held back by `line_layout`.
+struct layout_token {
+    enum kind_t { text, line, closing_line, begin, end };
+
+    kind_t kind;
+    std::size_t offset; // of the text (or the flat line break) in the text
+    std::size_t size;   // of the text, or width of a closed group
+    std::size_t match;  // index of the end token of a closed group
+};
+
+/// Decision on a closed group found by `line_layout` while flushing.
+struct layout_decision {
+    bool broken;
+    std::size_t indent;
 };
 
 /**
- * Unimplemented function that provides a value of a given type.
- *
- * This function cannot be called but it can be used in `decltype(...)` to get
- * a type of expressions using values of a given type.
+ * Scratch memory of the calling thread, reused across `repr()` calls so that
+ * threads rendering at the same time don't contend on the global allocator.
  */
-template <typename T> T val();
-
-// function type (NOT std::function)
-// Has to come before pointers as function types are infinitely-dereferencable
-// pointer-like things.
-template <typename T,
-          typename = typename enable_if<is_function<T>::value>::type>
-void repr_stream(std::ostream& out, const T& x, overload_priority<0>)
+class scratch_pool
 {
-    out << "<function@" << &x << ">";
-}
+  public:
+    static scratch_pool& local()
+    {
+        static thread_local scratch_pool pool;
+        return pool;
+    }
 
-// string-like: char*, const char*, char[], and std::string
-template <typename T,
-          typename = typename enable_if<is_string_like<T>::value>::type>
-void repr_stream(std::ostream& out, const T& x, overload_priority<1>)
-{
-    out << "\"" << x << "\"";
-}
+    buffer_pool<std::string>& strings() { return strings_; }
 
-// pointers dumb and smart
-template <typename T, typename = decltype(*val<T>()),
-          typename = decltype(!val<T>())>
-void repr_stream(std::ostream& out, const T& x, overload_priority<2>)
-{
-    if (!x)
-        out << "nullptr"; // also includes some "false" iterators
-    else
-        out << repr(*x);
-}
+    buffer_pool<std::vector<std::size_t>>& offsets() { return offsets_; }
 
-// iterators and smart pointers that don't support conversions to bool
-template <typename T, typename = decltype(*val<T>())>
-void repr_stream(std::ostream& out, const T& x, overload_priority<3>)
-{
-    out << repr(*x);
-}
+    buffer_pool<std::vector<layout_group>>& groups() { return groups_; }
 
-#ifdef ENABLE_REPR_LLVM
-// all LLVM values
-template <typename T,
-          typename = decltype(repr_debug_loc(val<std::ostream&>(), val<T&>()))>
-void repr_stream(std::ostream& out, const T& x, overload_priority<4>)
-{
-    std::string name = x.getName().str();
+    buffer_pool<std::vector<layout_token>>& tokens() { return tokens_; }
 
-    if (name.size() > 0) {
-        out << name;
-    } else {
-        std::string result;
-        llvm::raw_string_ostream raw(result);
-        raw << x;
-        out << result;
+    buffer_pool<std::vector<layout_decision>>& decisions()
+    {
+        return decisions_;
     }
 
-    repr_debug_loc(out, x);
-}
-#endif
-
-// tuples and tuple-like things like std::pair and std::array
-template <typename T, typename = decltype(std::get<0>(val<T>()))>
-void repr_stream(std::ostream& out, const T& x, overload_priority<5>)
-{
-    tuple_repr<T, std::tuple_size<T>::value> tr;
-    std::vector<std::string> sub_reprs;
-    tr(x, &sub_reprs);
+    /// Bytes of capacity kept for each kind of buffer.
+    std::size_t limit() const { return limit_; }
 
-    out << "(";
-    bool needs_comma = false;
-    for (auto& x : sub_reprs) {
-        if (needs_comma)
-            out << ", ";
+    void set_limit(std::size_t limit)
+    {
+        limit_ = limit;
+        release();
+    }
 
-        out << x;
-        needs_comma = true;
+    void release()
+    {
+        strings_.release();
+        offsets_.release();
+        groups_.release();
+        tokens_.release();
+        decisions_.release();
     }
-    out << ")";
-}
 
-// ostream-printable
-template <typename T, typename = decltype(std::cout << val<T>())>
-void repr_stream(std::ostream& out, const T& x, overload_priority<6>)
+  private:
+    std::size_t limit_ = 1 << 20;
+    buffer_pool<std::string> strings_;
+    buffer_pool<std::vector<std::size_t>> offsets_;
+    buffer_pool<std::vector<layout_group>> groups_;
+    buffer_pool<std::vector<layout_token>> tokens_;
+    buffer_pool<std::vector<layout_decision>> decisions_;
+};
+
+// pool of the calling thread for buffers of the type pointed to
+inline buffer_pool<std::string>& local_pool(std::string*)
 {
-    std::ios::fmtflags oldflags(out.flags());
-    out << std::boolalpha << x;
-    out.flags(oldflags);
+    return scratch_pool::local().strings();
 }
 
-// iterable (container) of pairs; print like a map
-template <typename T, typename = decltype(val<T>().begin()->first),
-          typename = decltype(val<T>().begin()->second)>
-void repr_stream(std::ostream& out, const T& xs, overload_priority<7>)
+inline buffer_pool<std::vector<std::size_t>>&
+local_pool(std::vector<std::size_t>*)
 {
-    bool needs_comma = false;
-    out << "{";
-
-    for (const auto& x : xs) {
-        if (needs_comma)
-            out << ", ";
-
-        out << repr(x.first) << ": " << repr(x.second);
-        needs_comma = true;
-    }
+    return scratch_pool::local().offsets();
+}
 
-    out << "}";
+inline buffer_pool<std::vector<layout_group>>&
+local_pool(std::vector<layout_group>*)
+{
+    return scratch_pool::local().groups();
 }
 
-// iterable (container) of chars; print like a string
-// FIXME: ugly blob of template magic
-template <typename T,
-          typename = typename enable_if<is_same<
-              char, typename remove_cv<typename remove_reference<decltype(
-                        *(val<T>().begin()))>::type>::type>::value>::type>
-void repr_stream(std::ostream& out, const T& xs, overload_priority<8>)
+inline buffer_pool<std::vector<layout_token>>&
+local_pool(std::vector<layout_token>*)
 {
-    out << "\"";
-    for (auto x : xs) {
-        out << x;
-    }
-    out << "\"";
+    return scratch_pool::local().tokens();
 }
 
-// iterable
-template <typename T, typename = decltype(val<T>().begin())>
-void repr_stream(std::ostream& out, const T& xs, overload_priority<9>)
+inline buffer_pool<std::vector<layout_decision>>&
+local_pool(std::vector<layout_decision>*)
 {
-    bool needs_brackets = false;
-    std::vector<std::string> contents;
+    return scratch_pool::local().decisions();
+}
 
-    for (const auto& x : xs) {
-        std::string repr_x = repr(x);
+/// Scratch buffer taken from the thread's pool and given back when done.
+template <typename Buffer> class scratch
+{
+  public:
+    scratch() : buf_(local_pool(static_cast<Buffer*>(nullptr)).take())
+    {
+#ifdef ENABLE_REPR_STATS
+        capacity_ = buf_.capacity();
+#endif
+    }
 
-        bool x_needs_brackets = false;
-        for (char c : repr_x) {
-            if (std::isspace(c) || c == ',')
-                x_needs_brackets = true;
-        }
+    ~scratch()
+    {
+#ifdef ENABLE_REPR_STATS
+        // a buffer from the pool that was too small had to be grown
+        if (buf_.capacity() > capacity_)
+            ++thread_stats::local().scratch_growths;
+#endif
+        local_pool(static_cast<Buffer*>(nullptr))
+            .give(std::move(buf_), scratch_pool::local().limit());
+    }
 
-        // bracketing possibly not needed if contents are already delimited
-        if (repr_x.size() >= 2) {
-            char a = repr_x[0];
-            char b = repr_x[repr_x.size() - 1];
+    scratch(const scratch&) = delete;
+    scratch& operator=(const scratch&) = delete;
 
-            if (a == '{' && b == '}')
-                x_needs_brackets = false;
+    Buffer& operator*() { return buf_; }
+    Buffer* operator->() { return &buf_; }
+    const Buffer& operator*() const { return buf_; }
+    const Buffer* operator->() const { return &buf_; }
 
-            if (a == '[' && b == ']')
-                x_needs_brackets = false;
-        }
+  private:
+    Buffer buf_;
+#ifdef ENABLE_REPR_STATS
+    std::size_t capacity_;
+#endif
+};
 
-        needs_brackets = needs_brackets || x_needs_brackets;
-        contents.push_back(std::move(repr_x));
+/**
+ * Output into a fixed-size, caller-supplied buffer.
+ *
+ * Whatever does not fit is dropped and the output is marked as truncated and
+ * done. Never allocates.
+ */
+class array_output : public output
+{
+  public:
+    array_output(char* buf, std::size_t size) : begin_(buf)
+    {
+        pos_ = buf;
+        end_ = buf + size;
     }
 
-    bool needs_comma = false;
-    out << "[";
-    for (const std::string& x : contents) {
-        if (needs_comma)
-            out << ", ";
+    std::size_t size() const { return static_cast<std::size_t>(pos_ - begin_); }
 
-        if (needs_brackets)
-            out << "<" << x << ">";
-        else
-            out << x;
+    bool truncated() const { return truncated_; }
 
-        needs_comma = true;
+  protected:
+    void overflow(const char* data, std::size_t) override
+    {
+        pos_ = std::copy(data, data + (end_ - pos_), pos_);
+        truncated_ = done_ = true;
     }
-    out << "]";
-}
 
-#ifdef ENABLE_REPR_LLVM
-// other LLVM objects that can be printed to a raw_ostream
-template <typename T,
+  private:
+    char* begin_;
+    bool truncated_ = false;
+};
+
+/**
+ * Output through an output iterator, buffered in small chunks.
+ *
+ * Call `finish()` to flush the last chunk and get the final iterator.
+ */
+template <typename It> class iterator_output : public output
+{
+  public:
+    explicit iterator_output(It it) : it_(it)
+    {
+        pos_ = chunk_;
+        end_ = chunk_ + sizeof(chunk_);
+    }
+
+    It finish()
+    {
+        it_ = std::copy(chunk_, pos_, it_);
+        pos_ = chunk_;
+        return it_;
+    }
+
+  protected:
+    void overflow(const char* data, std::size_t size) override
+    {
+        finish();
+
+        if (size > sizeof(chunk_))
+            it_ = std::copy(data, data + size, it_);
+        else
+            pos_ = std::copy(data, data + size, pos_);
+    }
+
+  private:
+    It it_;
+    char chunk_[256];
+};
+
+/**
+ * Output to a stream with a `write(data, size)` member, like `std::ostream`
+ * or `llvm::raw_ostream`, buffered in small chunks.
+ *
+ * Call `finish()` to flush the last chunk.
+ */
+template <typename Stream> class stream_output : public output
+{
+  public:
+    explicit stream_output(Stream& stream) : stream_(stream)
+    {
+        pos_ = chunk_;
+        end_ = chunk_ + sizeof(chunk_);
+    }
+
+    void finish()
+    {
+        stream_.write(chunk_, pos_ - chunk_);
+        pos_ = chunk_;
+    }
+
+  protected:
+    void overflow(const char* data, std::size_t size) override
+    {
+        finish();
+
+        if (size > sizeof(chunk_))
+            stream_.write(data, size);
+        else
+            pos_ = std::copy(data, data + size, pos_);
+    }
+
+  private:
+    Stream& stream_;
+    char chunk_[256];
+};
+
+#ifdef REPR_POSIX_IO
+/**
+ * Output writing to a file descriptor in chunks of `chunk_size` bytes. Large
+ * blocks of data are passed to `writev()` along with the chunk, without being
+ * copied into it first.
+ *
+ * Once writing fails the output is `failed()` and done. Call `finish()` to
+ * write out the last chunk.
+ */
+class fd_output : public output
+{
+  public:
+    static const std::size_t chunk_size = 1 << 16;
+
+    explicit fd_output(int fd) : fd_(fd)
+    {
+        chunk_->resize(chunk_size);
+        begin_ = pos_ = &(*chunk_)[0];
+        end_ = begin_ + chunk_size;
+    }
+
+    bool failed() const { return failed_; }
+
+    void finish() { flush(nullptr, 0); }
+
+  protected:
+    void overflow(const char* data, std::size_t size) override
+    {
+        if (size >= chunk_size / 2) {
+            flush(data, size);
+            return;
+        }
+
+        // fill up the chunk, so that only full chunks are written
+        std::size_t fits = static_cast<std::size_t>(end_ - pos_);
+        pos_ = std::copy(data, data + fits, pos_);
+        flush(nullptr, 0);
+        pos_ = std::copy(data + fits, data + size, pos_);
+    }
+
+  private:
+    // write the chunk followed by `data`
+    void flush(const char* data, std::size_t size)
+    {
+        iovec iov[2];
+        iov[0].iov_base = begin_;
+        iov[0].iov_len = static_cast<std::size_t>(pos_ - begin_);
+        iov[1].iov_base = const_cast<char*>(data);
+        iov[1].iov_len = size;
+
+        iovec* first = iov;
+        int count = 2;
+        pos_ = begin_;
+
+        while (!failed_) {
+            while (count > 0 && first->iov_len == 0) {
+                ++first;
+                --count;
+            }
+
+            if (count == 0)
+                break;
+
+            ssize_t written = ::writev(fd_, first, count);
+
+            if (written < 0) {
+                if (errno != EINTR)
+                    failed_ = done_ = true;
+                continue;
+            }
+
+            // skip what was written, possibly ending within a block
+            std::size_t left = static_cast<std::size_t>(written);
+            for (; count > 0 && left >= first->iov_len; ++first, --count)
+                left -= first->iov_len;
+
+            if (count > 0) {
+                first->iov_base = static_cast<char*>(first->iov_base) + left;
+                first->iov_len -= left;
+            }
+        }
+    }
+
+    int fd_;
+    scratch<std::string> chunk_;
+    char* begin_;
+    bool failed_ = false;
+};
+#endif
+
+/**
+ * Test whether `data` contains whitespace or commas.
+ *
+ * Looks at 32 or 16 bytes at a time where AVX2 or SSE2 are available.
+ */
+inline bool has_delimiter(const char* data, std::size_t size)
+{
+    const char* end = data + size;
+
+#ifdef __AVX2__
+    {
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i comma = _mm256_set1_epi8(',');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i four = _mm256_set1_epi8(4);
+
+        for (; end - data >= 32; data += 32) {
+            __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            // '\t' to '\r' are consecutive, so test (c - '\t') <= 4 unsigned
+            __m256i ctrl = _mm256_sub_epi8(chunk, tab);
+            __m256i hits = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                                _mm256_cmpeq_epi8(chunk, comma)),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, four), ctrl));
+
+            if (_mm256_movemask_epi8(hits) != 0)
+                return true;
+        }
+    }
+#endif
+
+#ifdef __SSE2__
+    {
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i four = _mm_set1_epi8(4);
+
+        for (; end - data >= 16; data += 16) {
+            __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            // '\t' to '\r' are consecutive, so test (c - '\t') <= 4 unsigned
+            __m128i ctrl = _mm_sub_epi8(chunk, tab);
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                             _mm_cmpeq_epi8(chunk, comma)),
+                _mm_cmpeq_epi8(_mm_min_epu8(ctrl, four), ctrl));
+
+            if (_mm_movemask_epi8(hits) != 0)
+                return true;
+        }
+    }
+#endif
+
+    for (; data != end; ++data) {
+        if (is_space(*data) || *data == ',')
+            return true;
+    }
+
+    return false;
+}
+
+inline bool needs_escape(char c)
+{
+    unsigned char u = static_cast<unsigned char>(c);
+    return u < 0x20 || u == 0x7f || c == '"' || c == '\\';
+}
+
+/**
+ * Find the first character of `data` that may need escaping in a string,
+ * returning `size` if there is none.
+ *
+ * Looks at 32 or 16 bytes at a time where AVX2 or SSE2 are available.
+ */
+inline std::size_t find_escape(const char* data, std::size_t size)
+{
+    const char* begin = data;
+    const char* end = data + size;
+
+#ifdef __AVX2__
+    {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+        const __m256i last_ctrl = _mm256_set1_epi8(0x1f);
+
+        for (; end - data >= 32; data += 32) {
+            __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            // control characters are the ones with min(c, 0x1f) == c unsigned
+            __m256i hits = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                _mm256_cmpeq_epi8(chunk, backslash)),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(chunk, del),
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, last_ctrl),
+                                      chunk)));
+
+            if (_mm256_movemask_epi8(hits) != 0)
+                break;
+        }
+    }
+#endif
+
+#ifdef __SSE2__
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i last_ctrl = _mm_set1_epi8(0x1f);
+
+        for (; end - data >= 16; data += 16) {
+            __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            // control characters are the ones with min(c, 0x1f) == c unsigned
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                             _mm_cmpeq_epi8(chunk, backslash)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, del),
+                             _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_ctrl),
+                                            chunk)));
+
+            if (_mm_movemask_epi8(hits) != 0)
+                break;
+        }
+    }
+#endif
+
+    for (; data != end; ++data) {
+        if (needs_escape(*data))
+            break;
+    }
+
+    return static_cast<std::size_t>(data - begin);
+}
+
+/**
+ * Write `size` bytes at `data` as `2 * size` lowercase hex digits to `dst`.
+ *
+ * Converts 32 or 16 bytes at a time where AVX2 or SSE2 are available.
+ */
+inline void hex_encode(const unsigned char* data, std::size_t size, char* dst)
+{
+    const unsigned char* end = data + size;
+
+#ifdef __AVX2__
+    {
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        const __m256i zero = _mm256_set1_epi8('0');
+        const __m256i nine = _mm256_set1_epi8(9);
+        const __m256i letters = _mm256_set1_epi8('a' - '0' - 10);
+
+        for (; end - data >= 32; data += 32, dst += 64) {
+            __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble);
+            __m256i lo = _mm256_and_si256(chunk, nibble);
+            // '0' + n, and then 'a' - '0' - 10 more for n > 9
+            hi = _mm256_add_epi8(
+                _mm256_add_epi8(hi, zero),
+                _mm256_and_si256(_mm256_cmpgt_epi8(hi, nine), letters));
+            lo = _mm256_add_epi8(
+                _mm256_add_epi8(lo, zero),
+                _mm256_and_si256(_mm256_cmpgt_epi8(lo, nine), letters));
+
+            // unpacking works within 128-bit lanes, so put them back in order
+            __m256i a = _mm256_unpacklo_epi8(hi, lo);
+            __m256i b = _mm256_unpackhi_epi8(hi, lo);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                                _mm256_permute2x128_si256(a, b, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32),
+                                _mm256_permute2x128_si256(a, b, 0x31));
+        }
+    }
+#endif
+
+#ifdef __SSE2__
+    {
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i zero = _mm_set1_epi8('0');
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i letters = _mm_set1_epi8('a' - '0' - 10);
+
+        for (; end - data >= 16; data += 16, dst += 32) {
+            __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble);
+            __m128i lo = _mm_and_si128(chunk, nibble);
+            // '0' + n, and then 'a' - '0' - 10 more for n > 9
+            hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+                              _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letters));
+            lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+                              _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letters));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                             _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16),
+                             _mm_unpackhi_epi8(hi, lo));
+        }
+    }
+#endif
+
+    const char* digits = "0123456789abcdef";
+
+    for (; data != end; ++data) {
+        *dst++ = digits[*data >> 4];
+        *dst++ = digits[*data & 15];
+    }
+}
+
+/**
+ * Test whether an element of a container has to be surrounded by `<...>`.
+ *
+ * This is the case if it contains whitespace or commas, unless it is already
+ * delimited by braces or square brackets.
+ */
+inline bool needs_brackets(const char* data, std::size_t size)
+{
+    if (size >= 2) {
+        char a = data[0];
+        char b = data[size - 1];
+
+        if ((a == '{' && b == '}') || (a == '[' && b == ']'))
+            return false;
+    }
+
+    return has_delimiter(data, size);
+}
+
+/**
+ * Output that stores nothing and only checks whether the text written since
+ * the last `reset()` would need bracketing (see `needs_brackets()`).
+ *
+ * It reports itself as `done()` as soon as the answer can't change anymore,
+ * so that a probed element is usually not rendered in full.
+ */
+class scan_output : public output
+{
+  public:
+    /// Start on the text of the next element.
+    void reset()
+    {
+        size_ = 0;
+        first_ = last_ = 0;
+        delimiters_ = false;
+        done_ = stopped_ || total_ > limit_;
+    }
+
+    /// Stop scanning for good, e.g. once the outcome is known.
+    void stop() { stopped_ = done_ = true; }
+
+    /**
+     * Stop scanning once the text of all elements together exceeds `limit`
+     * bytes; past that it can't make it into the output anyway.
+     */
+    void set_limit(std::size_t limit) { limit_ = limit; }
+
+    bool needs_brackets() const
+    {
+        if (size_ >= 2 && ((first_ == '{' && last_ == '}') ||
+                           (first_ == '[' && last_ == ']')))
+            return false;
+
+        return delimiters_;
+    }
+
+  protected:
+    void overflow(const char* data, std::size_t size) override
+    {
+        if (size == 0)
+            return;
+
+        if (size_ == 0)
+            first_ = data[0];
+
+        last_ = data[size - 1];
+        size_ += size;
+
+        if (!delimiters_)
+            delimiters_ = has_delimiter(data, size);
+
+        // only text delimited by {...} or [...] can be exempt
+        total_ += size;
+        done_ = (delimiters_ && first_ != '{' && first_ != '[') ||
+                total_ > limit_;
+    }
+
+  private:
+    std::size_t total_ = 0;
+    std::size_t limit_ = std::numeric_limits<std::size_t>::max();
+    bool stopped_ = false;
+    std::size_t size_ = 0;
+    char first_ = 0;
+    char last_ = 0;
+    bool delimiters_ = false;
+};
+
+/**
+ * The objects reached through pointers during a single render, for
+ * `repr_options::track_pointers`.
+ *
+ * Objects are identified by their address together with their type, so that
+ * an object and its first member are told apart.
+ */
+class node_tracker
+{
+  public:
+    /// How an object was found when visiting it.
+    struct visit {
+        /// 0 if the object is new, otherwise its number.
+        std::size_t id;
+
+        /// Whether the object is still being rendered, i.e. this is a cycle.
+        bool active;
+    };
+
+    template <typename T> visit enter(const T& x)
+    {
+        key k = {static_cast<const void*>(std::addressof(x)), &type_id<T>::id};
+        auto res =
+            nodes_.insert(std::make_pair(k, node{order_.size() + 1, true}));
+
+        if (!res.second) {
+            visit result = {res.first->second.id, res.first->second.active};
+            return result;
+        }
+
+        order_.push_back(k);
+        visit result = {0, true};
+        return result;
+    }
+
+    /// Mark the object last entered as new as fully rendered.
+    template <typename T> void leave(const T& x)
+    {
+        key k = {static_cast<const void*>(std::addressof(x)), &type_id<T>::id};
+        auto it = nodes_.find(k);
+
+        if (it != nodes_.end())
+            it->second.active = false;
+    }
+
+    /// Number of objects visited so far; see `rollback()`.
+    std::size_t mark() const { return order_.size(); }
+
+    /// Forget the objects visited since `mark()` returned `mark`.
+    void rollback(std::size_t mark)
+    {
+        while (order_.size() > mark) {
+            nodes_.erase(order_.back());
+            order_.pop_back();
+        }
+    }
+
+  private:
+    template <typename T> struct type_id {
+        static const char id;
+    };
+
+    struct key {
+        const void* address;
+        const char* type;
+
+        bool operator==(const key& other) const
+        {
+            return address == other.address && type == other.type;
+        }
+    };
+
+    struct key_hash {
+        std::size_t operator()(const key& k) const
+        {
+            std::hash<const void*> hash;
+            return hash(k.address) ^ (hash(k.type) << 1);
+        }
+    };
+
+    struct node {
+        std::size_t id;
+        bool active;
+    };
+
+    std::unordered_map<key, node, key_hash> nodes_;
+    std::vector<key> order_;
+};
+
+template <typename T> const char node_tracker::type_id<T>::id = 0;
+
+class writer;
+
+/**
+ * Line breaking for `repr_options::line_width`, in the style of Oppen's
+ * pretty-printer.
+ *
+ * Text comes in with groups (containers) around it and places where lines
+ * can be broken in between. A group is laid out flat if it fits on the rest
+ * of the line, or broken at each of its places otherwise. Text is held back
+ * only while that isn't decided: once the text of the outermost undecided
+ * group goes past the end of the line, that group is broken and its text up
+ * to the next undecided group is written out. So text is written in a single
+ * pass, and at most a line's worth of it is held back.
+ */
+class line_layout
+{
+  public:
+    line_layout(writer& out, std::size_t width, std::size_t indent)
+        : out_(out), width_(width), step_(indent)
+    {
+    }
+
+    void text(const char* data, std::size_t size)
+    {
+        if (empty()) {
+            write(data, size);
+            return;
+        }
+
+        push(token::text, data, size);
+        fit();
+    }
+
+    void begin_group()
+    {
+        group g = {group::undecided, 0, flat_pos_, flushed_ + held()};
+        open_->push_back(g);
+        push(token::begin, nullptr, 0);
+    }
+
+    void end_group()
+    {
+        group g = open_->back();
+        open_->pop_back();
+
+        if (g.state == group::broken)
+            return;
+
+        token& begin = at(g.token);
+        begin.size = flat_pos_ - g.flat_pos;
+        begin.match = flushed_ + held();
+        push(token::end, nullptr, 0);
+
+        // The outermost undecided group is laid out once the text after it up
+        // to the next line break is known, e.g. a separator; see flush().
+    }
+
+    /// Place to break the line at; `closing` ones (before the closing
+    /// bracket) go back to the indentation of the group.
+    void line_break(const char* flat, std::size_t size, bool closing)
+    {
+        const group& g = open_->back();
+
+        if (g.state == group::broken) {
+            finish();
+            new_line(closing ? g.indent - step_ : g.indent);
+            return;
+        }
+
+        push(closing ? token::closing_line : token::line, flat, size);
+        fit();
+    }
+
+    /// Write out whatever is held back, flat.
+    void finish()
+    {
+        while (!empty())
+            flush();
+    }
+
+  private:
+    typedef layout_group group;
+    typedef layout_token token;
+    typedef layout_decision decided;
+
+    bool empty() const { return head_ == tokens_->size(); }
+
+    std::size_t held() const { return tokens_->size() - head_; }
+
+    // token with the index `index`, counted from the first one ever
+    token& at(std::size_t index)
+    {
+        return (*tokens_)[index - flushed_ + head_];
+    }
+
+    const token& at(std::size_t index) const
+    {
+        return (*tokens_)[index - flushed_ + head_];
+    }
+
+    void pop_front()
+    {
+        ++head_;
+        ++flushed_;
+
+        if (empty()) {
+            tokens_->clear();
+            head_ = 0;
+        }
+    }
+
+    void push(typename token::kind_t kind, const char* data, std::size_t size)
+    {
+        token t = {kind, text_->size(), size, 0};
+
+        if (kind == token::begin)
+            t.size = std::numeric_limits<std::size_t>::max();
+
+        text_->append(data, size);
+        flat_pos_ += size;
+        pending_ += size;
+        tokens_->push_back(t);
+    }
+
+    // break undecided groups for as long as their text doesn't fit
+    void fit()
+    {
+        while (!empty() && column_ + pending_ > width_) {
+            // the outermost undecided group is the first one that isn't broken
+            std::size_t indent = 0;
+            for (group& g : *open_) {
+                if (g.state == group::broken) {
+                    indent = g.indent;
+                    continue;
+                }
+
+                g.state = group::broken;
+                g.indent = indent + step_;
+                break;
+            }
+
+            flush();
+        }
+    }
+
+    // Write out tokens up to the next group which is still open and
+    // undecided, laying out the closed groups on the way.
+    void flush()
+    {
+        std::vector<decided>& closed = *closed_;
+        closed.clear();
+
+        for (bool first = true; !empty(); first = false) {
+            const token t = (*tokens_)[head_];
+            const char* data = text_->data() + t.offset;
+
+            if (t.kind == token::begin) {
+                bool open = t.size == std::numeric_limits<std::size_t>::max();
+
+                if (open && !first)
+                    break;
+
+                if (!open) {
+                    std::size_t indent =
+                        closed.empty() ? open_indent() : closed.back().indent;
+                    bool fits =
+                        column_ + t.size + trailing_size(t.match) <= width_;
+                    closed.push_back({!fits, fits ? indent : indent + step_});
+                }
+            } else if (t.kind == token::end) {
+                closed.pop_back();
+            } else if (t.kind == token::text) {
+                write(data, t.size);
+            } else {
+                bool is_broken = closed.empty() || closed.back().broken;
+                std::size_t indent =
+                    closed.empty() ? open_indent() : closed.back().indent;
+
+                if (!is_broken)
+                    write(data, t.size);
+                else
+                    new_line(t.kind == token::closing_line ? indent - step_
+                                                           : indent);
+            }
+
+            pending_ -= t.kind == token::begin ? 0 : t.size;
+            pop_front();
+        }
+
+        if (empty()) {
+            text_->clear();
+            pending_ = 0;
+        }
+    }
+
+    // width of the text after the end token `end` up to the next line break
+    std::size_t trailing_size(std::size_t end) const
+    {
+        std::size_t size = 0;
+
+        for (std::size_t i = end + 1; i < flushed_ + held(); ++i) {
+            if (at(i).kind == token::text)
+                size += at(i).size;
+            else if (at(i).kind != token::end)
+                break;
+        }
+
+        return size;
+    }
+
+    // indentation of the innermost broken group that is open
+    std::size_t open_indent() const
+    {
+        std::size_t indent = 0;
+
+        for (const group& g : *open_) {
+            if (g.state == group::broken)
+                indent = g.indent;
+        }
+
+        return indent;
+    }
+
+    void new_line(std::size_t indent);
+    void write(const char* data, std::size_t size);
+
+    writer& out_;
+    std::size_t width_;
+    std::size_t step_;
+    std::size_t column_ = 0;
+    std::size_t flat_pos_ = 0;
+    std::size_t pending_ = 0; // flat width of the tokens held back
+    std::size_t flushed_ = 0; // number of tokens written out so far
+    std::size_t head_ = 0;    // of the first token held back in tokens_
+
+    // all taken from the thread's scratch memory, so that laying out doesn't
+    // allocate once the buffers have grown
+    scratch<std::vector<group>> open_;
+    scratch<std::vector<token>> tokens_;
+    scratch<std::vector<decided>> closed_;
+    scratch<std::string> text_;
+};
+
+/**
+ * Rendering state shared by all the `repr_stream` overloads.
+ *
+ * Everything rendered during a single `repr()` call goes to one `output`.
+ * Nested values are rendered in place between `begin_element()` and
+ * `end_element()`, which drops their leading and trailing whitespace just like
+ * the trimming done by a top-level `repr()`. Trailing whitespace is held back
+ * until it is known not to be at the edge of an element, so nothing ever has
+ * to be erased from the output.
+ *
+ * The writer also keeps track of the nesting depth and the byte budget from
+ * `repr_options`. Once the byte budget is used up it writes `...` and becomes
+ * `done()`. Call `finish()` at the end of rendering.
+ */
+class writer
+{
+  public:
+    /// State saved by `begin_element()`.
+    struct element {
+        bool outer_skip_space;
+    };
+
+    writer(output& out, const repr_options& options)
+        : out_(&out), options_(&options)
+    {
+        if (options.max_bytes != 0) {
+            reserve_ = std::min<std::size_t>(options.max_bytes, 3);
+            remaining_ = options.max_bytes - reserve_;
+        }
+
+        if (options.track_pointers) {
+            own_nodes_.reset(new node_tracker());
+            nodes_ = own_nodes_.get();
+        }
+
+        if (options.line_width != 0) {
+            layout_ = new (&layout_storage_)
+                line_layout(*this, options.line_width, options.indent_width);
+        }
+    }
+
+    /**
+     * Writer rendering into `out` on behalf of `parent`, with its options.
+     *
+     * A probing writer is used to look at the text of elements before they
+     * are written for real; see the iterable overload.
+     */
+    writer(output& out, const writer& parent, bool probing)
+        : out_(&out), options_(parent.options_), depth_(parent.depth_),
+          nodes_(parent.nodes_), probing_(probing || parent.probing_)
+    {
+    }
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    ~writer()
+    {
+        if (has_stream_)
+            stream_adaptor_ptr()->~stream_adaptor();
+        if (layout_)
+            layout_->~line_layout();
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        const char* end = data + size;
+
+        if (skip_space_) {
+            while (data != end && is_space(*data))
+                ++data;
+
+            if (data == end)
+                return;
+        }
+
+        const char* last = end;
+        while (last != data && is_space(last[-1]))
+            --last;
+
+        if (last != data) {
+            commit_pending();
+            emit(data, static_cast<std::size_t>(last - data));
+        }
+
+        count_bytes(static_cast<std::size_t>(end - last));
+        pending_.append(last, end);
+    }
+
+    void write(const char* str) { write(str, std::strlen(str)); }
+
+    void write(const std::string& str) { write(str.data(), str.size()); }
+
+    /**
+     * Write text that is known to be followed by something other than
+     * whitespace within the current element, e.g. the inside of a quoted
+     * string. It is copied as-is without looking for whitespace.
+     */
+    void write_verbatim(const char* data, std::size_t size)
+    {
+        commit_pending();
+        emit(data, size);
+    }
+
+    void put(char c)
+    {
+        if (!is_space(c)) {
+            commit_pending();
+
+            if (layout_) {
+                emit(&c, 1);
+                return;
+            }
+
+            count_bytes(1);
+            if (remaining_ != 0) {
+                --remaining_;
+                out_->push_back(c);
+            } else {
+                emit_over_budget(&c, 1);
+            }
+        } else if (!skip_space_) {
+            count_bytes(1);
+            pending_.push_back(c);
+        }
+    }
+
+    /// Start a group of elements, e.g. a container; see `line_layout`.
+    void begin_group()
+    {
+        if (layout_) {
+            commit_pending();
+            layout_->begin_group();
+        }
+    }
+
+    void end_group()
+    {
+        if (layout_)
+            layout_->end_group();
+    }
+
+    /**
+     * Place where a line can be broken within the current group, with `flat`
+     * written instead if it isn't. Without `repr_options::line_width` it's
+     * always `flat`.
+     */
+    void line_break(const char* flat, std::size_t size, bool closing = false)
+    {
+        if (!layout_) {
+            write(flat, size);
+            return;
+        }
+
+        commit_pending();
+        layout_->line_break(flat, size, closing);
+    }
+
+    /// Start rendering a nested value.
+    element begin_element()
+    {
+        element result = {skip_space_};
+        skip_space_ = true;
+        return result;
+    }
+
+    /// Finish rendering a nested value, dropping its trailing whitespace.
+    void end_element(const element& elem)
+    {
+        if (skip_space_)
+            skip_space_ = elem.outer_skip_space; // nothing was written
+        else
+            pending_.clear();
+    }
+
+    const repr_options& options() const { return *options_; }
+
+    /// Whether this writer only renders text to inspect it.
+    bool probing() const { return probing_; }
+
+    /// Whether rendering can stop early; see `output::done()`.
+    bool done() const { return truncated_ || out_->done(); }
+
+    /// Whether the output was cut short by `repr_options::max_bytes`.
+    bool truncated() const { return truncated_; }
+
+    /// Upper bound on the number of bytes that can still be written.
+    std::size_t remaining_bytes() const
+    {
+        return remaining_ + (reserve_ - held_size_);
+    }
+
+    /// Write out what was held back for the end of the byte budget.
+    void finish()
+    {
+        if (layout_)
+            layout_->finish();
+
+        if (!truncated_)
+            out_->append(held_, held_size_);
+        held_size_ = 0;
+    }
+
+    /// Objects seen through pointers, or nullptr if they aren't tracked.
+    node_tracker* nodes() const { return nodes_; }
+
+    /// Nesting depth of the container being rendered.
+    std::size_t depth() const { return depth_; }
+
+    /// Enter a nested container, unless that would exceed `max_depth`.
+    bool enter()
+    {
+        if (options_->max_depth != 0 && depth_ >= options_->max_depth)
+            return false;
+
+        ++depth_;
+        return true;
+    }
+
+    void leave() { --depth_; }
+
+    /**
+     * Stream for rendering values with their `operator<<`.
+     *
+     * The stream writes straight into this writer. It is constructed in place
+     * on first use and reused afterwards; each call resets its formatting
+     * state. Call `end_stream()` when done.
+     */
+    std::ostream& stream()
+    {
+        if (!has_stream_) {
+            new (&stream_storage_) stream_adaptor(this);
+            has_stream_ = true;
+        }
+
+        std::ostream& os = stream_adaptor_ptr()->os;
+        os.clear();
+        os.flags(std::ios_base::skipws | std::ios_base::dec |
+                 std::ios_base::boolalpha);
+        os.precision(6);
+        os.width(0);
+        os.fill(' ');
+        return os;
+    }
+
+    void end_stream() { stream_adaptor_ptr()->buf.pubsync(); }
+
+  private:
+    class writer_streambuf : public std::streambuf
+    {
+      public:
+        explicit writer_streambuf(writer* w) : w_(w)
+        {
+            setp(buffer_, buffer_ + sizeof(buffer_));
+        }
+
+      protected:
+        int_type overflow(int_type ch) override
+        {
+            sync();
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                sputc(traits_type::to_char_type(ch));
+            return traits_type::not_eof(ch);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            sync();
+            w_->write(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+        int sync() override
+        {
+            w_->write(pbase(), static_cast<std::size_t>(pptr() - pbase()));
+            setp(buffer_, buffer_ + sizeof(buffer_));
+            return 0;
+        }
+
+      private:
+        writer* w_;
+        char buffer_[256];
+    };
+
+    struct stream_adaptor {
+        explicit stream_adaptor(writer* w) : buf(w), os(&buf) {}
+
+        writer_streambuf buf;
+        std::ostream os;
+    };
+
+    stream_adaptor* stream_adaptor_ptr()
+    {
+        return reinterpret_cast<stream_adaptor*>(&stream_storage_);
+    }
+
+    // whitespace is counted when it's written, not when it's committed
+    void commit_pending()
+    {
+        if (!pending_.empty()) {
+            emit_uncounted(pending_.data(), pending_.size());
+            pending_.clear();
+        }
+        skip_space_ = false;
+    }
+
+    // bytes written by the values being rendered, for repr_stats_snapshot()
+    static void count_bytes(std::size_t size)
+    {
+#ifdef ENABLE_REPR_STATS
+        thread_stats::local().bytes += size;
+#else
+        (void)size;
+#endif
+    }
+
+    void emit(const char* data, std::size_t size)
+    {
+        count_bytes(size);
+        emit_uncounted(data, size);
+    }
+
+    void emit_uncounted(const char* data, std::size_t size)
+    {
+        if (layout_)
+            layout_->text(data, size);
+        else
+            emit_laid_out(data, size);
+    }
+
+    // text as laid out, counted against the byte budget
+    void emit_laid_out(const char* data, std::size_t size)
+    {
+        if (size <= remaining_) {
+            remaining_ -= size;
+            out_->append(data, size);
+        } else {
+            emit_over_budget(data, size);
+        }
+    }
+
+    // The last few bytes of the budget are held back, so that they can be
+    // replaced by "..." if it turns out that there is more to write.
+    void emit_over_budget(const char* data, std::size_t size)
+    {
+        if (truncated_)
+            return;
+
+        out_->append(data, remaining_);
+        data += remaining_;
+        size -= remaining_;
+        remaining_ = 0;
+
+        if (held_size_ + size <= reserve_) {
+            std::copy(data, data + size, held_ + held_size_);
+            held_size_ += size;
+        } else {
+            out_->append("...", reserve_);
+            held_size_ = 0;
+            truncated_ = true;
+        }
+    }
+
+    output* out_;
+    const repr_options* options_;
+    std::size_t depth_ = 0;
+    std::size_t remaining_ = std::numeric_limits<std::size_t>::max();
+    std::size_t reserve_ = 0;
+    std::size_t held_size_ = 0;
+    char held_[3];
+    bool truncated_ = false;
+    std::unique_ptr<node_tracker> own_nodes_;
+    node_tracker* nodes_ = nullptr;
+    line_layout* layout_ = nullptr; // in layout_storage_
+    std::string pending_;
+    bool skip_space_ = true;
+    bool probing_ = false;
+    bool has_stream_ = false;
+    typename std::aligned_storage<sizeof(stream_adaptor),
+                                  alignof(stream_adaptor)>::type
+        stream_storage_;
+    typename std::aligned_storage<sizeof(line_layout),
+                                  alignof(line_layout)>::type layout_storage_;
+
+    friend class line_layout;
+};
+
+inline void line_layout::new_line(std::size_t indent)
+{
+    static const char spaces[] = "                                ";
+
+    out_.emit_laid_out("\n", 1);
+    column_ = indent;
+
+    for (; indent > 0; indent -= std::min(indent, sizeof(spaces) - 1))
+        out_.emit_laid_out(spaces, std::min(indent, sizeof(spaces) - 1));
+}
+
+inline void line_layout::write(const char* data, std::size_t size)
+{
+    out_.emit_laid_out(data, size);
+
+    const char* end = data + size;
+    const char* line = end;
+
+    while (line != data && line[-1] != '\n')
+        --line;
+
+    column_ = line == data ? column_ + size
+                           : static_cast<std::size_t>(end - line);
+}
+
+inline const char* digit_pairs()
+{
+    static const char pairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    return pairs;
+}
+
+// write the decimal digits of `value` backwards, ending at `end`
+template <typename T> char* format_decimal(char* end, T value)
+{
+    const char* pairs = digit_pairs();
+
+    while (value >= 100) {
+        const char* pair = pairs + 2 * (value % 100);
+        value /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+
+    if (value >= 10) {
+        const char* pair = pairs + 2 * value;
+        *--end = pair[1];
+        *--end = pair[0];
+    } else {
+        *--end = static_cast<char>('0' + value);
+    }
+
+    return end;
+}
+
+template <typename T> void write_decimal(writer& out, T value)
+{
+    typedef typename std::make_unsigned<T>::type unsigned_type;
+    unsigned_type abs = static_cast<unsigned_type>(value);
+
+    if (value < 0)
+        abs = static_cast<unsigned_type>(0 - abs);
+
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* begin = format_decimal(end, abs);
+
+    if (value < 0)
+        *--begin = '-';
+
+    out.write(begin, static_cast<std::size_t>(end - begin));
+}
+
+// same format as `std::ostream` uses for `void*`
+inline void write_address(writer& out, std::uintptr_t address)
+{
+    static const char digits[] = "0123456789abcdef";
+    char buf[2 + 2 * sizeof(address)];
+    char* end = buf + sizeof(buf);
+    char* begin = end;
+
+    do {
+        *--begin = digits[address & 0xf];
+        address >>= 4;
+    } while (address != 0);
+
+    *--begin = 'x';
+    *--begin = '0';
+    out.write(begin, static_cast<std::size_t>(end - begin));
+}
+
+/**
+ * Shortest decimal representation of binary floating-point numbers.
+ *
+ * This is the Grisu2 algorithm by Florian Loitsch ("Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", PLDI 2010): the result always
+ * reads back as the same number, and is the shortest such in all but very few
+ * cases. Only integer arithmetic is used, so it does not depend on the locale.
+ */
+namespace grisu
+{
+// f * 2^e
+struct diy_fp {
+    std::uint64_t f;
+    int e;
+};
+
+inline diy_fp normalize(diy_fp x)
+{
+    while ((x.f & (std::uint64_t(1) << 63)) == 0) {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
+}
+
+// upper 64 bits of the product, rounded
+inline diy_fp multiply(diy_fp x, diy_fp y)
+{
+    const std::uint64_t mask = 0xffffffff;
+    std::uint64_t a = x.f >> 32, b = x.f & mask;
+    std::uint64_t c = y.f >> 32, d = y.f & mask;
+    std::uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    std::uint64_t mid = (bd >> 32) + (ad & mask) + (bc & mask);
+    mid += std::uint64_t(1) << 31;
+
+    diy_fp result = {ac + (ad >> 32) + (bc >> 32) + (mid >> 32),
+                     x.e + y.e + 64};
+    return result;
+}
+
+// normalized 10^k for k = -348, -340, ..., 340
+inline diy_fp cached_power(int index)
+{
+    static const std::uint64_t significands[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+    0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+    0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+    0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+    0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+    0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+    0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+    0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+    0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+    0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+    0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+    0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+    0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+    0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+    0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+    0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+    0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+    0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+    0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+    0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+    0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+    0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b};
+    static const short exponents[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+    -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+    -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+    83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+    481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+    880, 907, 933, 960, 986, 1013, 1039, 1066};
+
+    diy_fp result = {significands[index], exponents[index]};
+    return result;
+}
+
+// power of ten bringing a number with binary exponent `e` into [2^-60, 2^-32]
+inline diy_fp cached_power_for(int e, int* k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = static_cast<int>(dk);
+    if (dk - ik > 0.0)
+        ++ik;
+
+    int index = (ik >> 3) + 1;
+    *k = -(-348 + index * 8);
+    return cached_power(index);
+}
+
+inline void round_weed(char* digits, int len, std::uint64_t delta,
+                       std::uint64_t rest, std::uint64_t ten_kappa,
+                       std::uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        --digits[len - 1];
+        rest += ten_kappa;
+    }
+}
+
+inline int count_digits(std::uint32_t n)
+{
+    int count = 1;
+    while (n >= 10) {
+        n /= 10;
+        ++count;
+    }
+    return count;
+}
+
+inline void generate_digits(diy_fp w, diy_fp mp, std::uint64_t delta,
+                            char* digits, int* len, int* k)
+{
+    static const std::uint64_t pow10[] = {1ull,
+                                          10ull,
+                                          100ull,
+                                          1000ull,
+                                          10000ull,
+                                          100000ull,
+                                          1000000ull,
+                                          10000000ull,
+                                          100000000ull,
+                                          1000000000ull,
+                                          10000000000ull,
+                                          100000000000ull,
+                                          1000000000000ull,
+                                          10000000000000ull,
+                                          100000000000000ull,
+                                          1000000000000000ull,
+                                          10000000000000000ull,
+                                          100000000000000000ull,
+                                          1000000000000000000ull,
+                                          10000000000000000000ull};
+    const int shift = -mp.e;
+    const std::uint64_t one = std::uint64_t(1) << shift;
+    const std::uint64_t wp_w = mp.f - w.f;
+    std::uint32_t p1 = static_cast<std::uint32_t>(mp.f >> shift);
+    std::uint64_t p2 = mp.f & (one - 1);
+    int kappa = count_digits(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        std::uint32_t d = static_cast<std::uint32_t>(p1 / pow10[kappa - 1]);
+        p1 %= static_cast<std::uint32_t>(pow10[kappa - 1]);
+
+        if (d != 0 || *len != 0)
+            digits[(*len)++] = static_cast<char>('0' + d);
+
+        --kappa;
+        std::uint64_t rest = (static_cast<std::uint64_t>(p1) << shift) + p2;
+
+        if (rest <= delta) {
+            *k += kappa;
+            round_weed(digits, *len, delta, rest, pow10[kappa] << shift, wp_w);
+            return;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = static_cast<char>(p2 >> shift);
+
+        if (d != 0 || *len != 0)
+            digits[(*len)++] = static_cast<char>('0' + d);
+
+        p2 &= one - 1;
+        --kappa;
+
+        if (p2 < delta) {
+            *k += kappa;
+            int index = -kappa;
+            round_weed(digits, *len, delta, p2, one,
+                       wp_w * (index < 20 ? pow10[index] : 0));
+            return;
+        }
+    }
+}
+
+/**
+ * Digits of the positive number `significand * 2^exponent` such that the
+ * value is `digits * 10^k`. `lower_closer` tells if the next smaller number of
+ * the same type is closer than the next larger one, which is the case at
+ * powers of two. At most 17 digits are produced.
+ */
+inline void shortest(std::uint64_t significand, int exponent,
+                     bool lower_closer, char* digits, int* len, int* k)
+{
+    diy_fp v = {significand, exponent};
+    diy_fp plus = {(v.f << 1) + 1, v.e - 1};
+    diy_fp minus = lower_closer ? diy_fp{(v.f << 2) - 1, v.e - 2}
+                                : diy_fp{(v.f << 1) - 1, v.e - 1};
+
+    plus = normalize(plus);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    diy_fp c_mk = cached_power_for(plus.e, k);
+    diy_fp w = multiply(normalize(v), c_mk);
+    diy_fp wp = multiply(plus, c_mk);
+    diy_fp wm = multiply(minus, c_mk);
+    ++wm.f;
+    --wp.f;
+
+    generate_digits(w, wp, wp.f - wm.f, digits, len, k);
+}
+} // namespace grisu
+
+/**
+ * Write `digits * 10^k` in the shortest of positional or scientific notation,
+ * the latter being used for exponents below -4 or above 15.
+ */
+inline void write_float_digits(writer& out, bool negative, const char* digits,
+                               int len, int k)
+{
+    char buf[32];
+    char* p = buf;
+    int exponent = len + k - 1; // of the first digit
+
+    if (negative)
+        *p++ = '-';
+
+    if (exponent < -4 || exponent > 15) {
+        *p++ = digits[0];
+
+        if (len > 1) {
+            *p++ = '.';
+            p = std::copy(digits + 1, digits + len, p);
+        }
+
+        *p++ = 'e';
+        *p++ = exponent < 0 ? '-' : '+';
+
+        int abs_exponent = exponent < 0 ? -exponent : exponent;
+        if (abs_exponent < 10)
+            *p++ = '0';
+
+        char exp_buf[4];
+        char* exp_end = exp_buf + sizeof(exp_buf);
+        p = std::copy(format_decimal(exp_end, abs_exponent), exp_end, p);
+    } else if (exponent < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        p = std::fill_n(p, -exponent - 1, '0');
+        p = std::copy(digits, digits + len, p);
+    } else if (len <= exponent + 1) {
+        p = std::copy(digits, digits + len, p);
+        p = std::fill_n(p, exponent + 1 - len, '0');
+    } else {
+        p = std::copy(digits, digits + exponent + 1, p);
+        *p++ = '.';
+        p = std::copy(digits + exponent + 1, digits + len, p);
+    }
+
+    out.write(buf, static_cast<std::size_t>(p - buf));
+}
+
+// replace the locale's decimal point in the output of snprintf() with '.'
+inline std::size_t fix_decimal_point(char* buf, std::size_t size)
+{
+    const char* point = std::localeconv()->decimal_point;
+    std::size_t point_len = std::strlen(point);
+
+    if (point_len == 0 || (point_len == 1 && point[0] == '.'))
+        return size;
+
+    char* found = std::search(buf, buf + size, point, point + point_len);
+    if (found == buf + size)
+        return size;
+
+    *found = '.';
+    std::copy(found + point_len, buf + size, found + 1);
+    return size - point_len + 1;
+}
+
+// `%.*g` with the given precision, or the shortest that reads back the same
+template <typename T>
+void write_float_printf(writer& out, T value, int precision)
+{
+    char buf[64];
+    int len = 0;
+
+    if (precision > 0) {
+        len = std::snprintf(buf, sizeof(buf), "%.*Lg", precision,
+                            static_cast<long double>(value));
+    } else {
+        for (precision = 1; precision <= 40; ++precision) {
+            len = std::snprintf(buf, sizeof(buf), "%.*Lg", precision,
+                                static_cast<long double>(value));
+            if (static_cast<T>(std::strtold(buf, nullptr)) == value)
+                break;
+        }
+    }
+
+    if (len < 0)
+        return;
+
+    std::size_t size = std::min(static_cast<std::size_t>(len), sizeof(buf) - 1);
+    out.write(buf, fix_decimal_point(buf, size));
+}
+
+// inf and nan are written the same way on all platforms; returns true if
+// `value` was one of them
+template <typename T> bool write_float_special(writer& out, T value)
+{
+    const char* text = nullptr;
+
+    if (value != value)
+        text = "nan";
+    else if (value == std::numeric_limits<T>::infinity())
+        text = "inf";
+    else if (value == -std::numeric_limits<T>::infinity())
+        text = "-inf";
+    else
+        return false;
+
+    // JSON has no such numbers
+    if (out.options().json) {
+        out.put('"');
+        out.write(text);
+        out.put('"');
+    } else {
+        out.write(text);
+    }
+
+    return true;
+}
+
+template <typename T> void write_number(writer& out, T value)
+{
+    write_decimal(out, value);
+}
+
+inline void write_number(writer& out, double value)
+{
+    if (write_float_special(out, value))
+        return;
+
+    int precision = out.options().float_precision;
+    if (precision > 0) {
+        write_float_printf(out, value, precision);
+        return;
+    }
+
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    bool negative = (bits >> 63) != 0;
+    int biased_exponent = static_cast<int>((bits >> 52) & 0x7ff);
+    std::uint64_t significand = bits & ((std::uint64_t(1) << 52) - 1);
+
+    if (biased_exponent == 0 && significand == 0) {
+        out.write(negative ? "-0" : "0");
+        return;
+    }
+
+    bool lower_closer = significand == 0 && biased_exponent > 1;
+    if (biased_exponent != 0)
+        significand |= std::uint64_t(1) << 52;
+    else
+        biased_exponent = 1;
+
+    char digits[20];
+    int len, k;
+    grisu::shortest(significand, biased_exponent - 1075, lower_closer, digits,
+                    &len, &k);
+    write_float_digits(out, negative, digits, len, k);
+}
+
+inline void write_number(writer& out, float value)
+{
+    if (write_float_special(out, value))
+        return;
+
+    int precision = out.options().float_precision;
+    if (precision > 0) {
+        write_float_printf(out, value, precision);
+        return;
+    }
+
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    bool negative = (bits >> 31) != 0;
+    int biased_exponent = static_cast<int>((bits >> 23) & 0xff);
+    std::uint32_t significand = bits & ((std::uint32_t(1) << 23) - 1);
+
+    if (biased_exponent == 0 && significand == 0) {
+        out.write(negative ? "-0" : "0");
+        return;
+    }
+
+    bool lower_closer = significand == 0 && biased_exponent > 1;
+    if (biased_exponent != 0)
+        significand |= std::uint32_t(1) << 23;
+    else
+        biased_exponent = 1;
+
+    char digits[20];
+    int len, k;
+    grisu::shortest(significand, biased_exponent - 150, lower_closer, digits,
+                    &len, &k);
+    write_float_digits(out, negative, digits, len, k);
+}
+
+// too wide for Grisu; slow, but correct
+inline void write_number(writer& out, long double value)
+{
+    if (!write_float_special(out, value))
+        write_float_printf(out, value, out.options().float_precision);
+}
+
+inline void write_number(writer& out, bool value)
+{
+    if (value)
+        out.write("true", 4);
+    else
+        out.write("false", 5);
+}
+
+template <typename T> void repr_stream(writer&, const T&);
+template <typename T> void repr_nested(writer&, const T&);
+} // namespace repr_impl
+
+/**
+ * Output of `repr()` as seen by `repr_append()` overloads.
+ *
+ * Types can define how they are rendered with an overload of
+ *
+ *     void repr_append(repr_writer& out, const T& x);
+ *
+ * in their namespace, found by argument-dependent lookup. It takes precedence
+ * over everything else, so such types aren't taken for containers, pointers
+ * or `operator<<`-printable ones. The overload writes straight into the
+ * output with `out.write()` and `out.put()`, and renders members and other
+ * values with `repr_append_nested()`, like the built-in representations do.
+ * The byte budget and line layout of `repr_options` apply to what it writes;
+ * `out.options()` gives the rest. In JSON the text is written as a string.
+ */
+typedef repr_impl::writer repr_writer;
+
+/// Render `x` as part of a value written by a `repr_append()` overload.
+template <typename T> void repr_append_nested(repr_writer& out, const T& x)
+{
+    repr_impl::repr_nested(out, x);
+}
+
+/**
+ * Limit the scratch memory the calling thread keeps for reuse by later
+ * `repr()` calls to `bytes` for each kind of buffer (1 MiB by default), and
+ * release what it keeps now. With 0 nothing is kept.
+ */
+inline void repr_scratch_limit(std::size_t bytes)
+{
+    repr_impl::scratch_pool::local().set_limit(bytes);
+}
+
+/// Free the scratch memory kept by the calling thread.
+inline void repr_release_scratch()
+{
+    repr_impl::scratch_pool::local().release();
+}
+
+/// Result of rendering into a fixed-size buffer with `repr_into()`.
+struct repr_into_result {
+    /// Number of bytes written to the buffer.
+    std::size_t size;
+
+    /// Whether the representation did not fit, or exceeded
+    /// `repr_options::max_bytes`, and was cut short.
+    bool truncated;
+};
+
+/**
+ * Append the representation of `x` to `out`.
+ *
+ * The whole object tree is rendered directly into `out`; this is what `repr()`
+ * uses internally and can be used to reuse a single buffer across calls.
+ */
+template <typename T>
+void repr_into(std::string& out, const T& x,
+               const repr_options& options = repr_options())
+{
+    repr_impl::string_output str_out(&out);
+    repr_impl::writer w(str_out, options);
+    repr_impl::repr_stream(w, x);
+    w.finish();
+    str_out.finish();
+}
+
+/**
+ * Render the representation of `x` into the buffer `buf` of size `size`.
+ *
+ * Output that doesn't fit is dropped. No terminating null character is
+ * written. Strings, numbers, pointers, tuples and containers of those are
+ * rendered without any heap allocation.
+ */
+template <typename T>
+repr_into_result repr_into(char* buf, std::size_t size, const T& x,
+                           const repr_options& options = repr_options())
+{
+    repr_impl::array_output arr_out(buf, size);
+    repr_impl::writer w(arr_out, options);
+    repr_impl::repr_stream(w, x);
+    w.finish();
+
+    repr_into_result result = {arr_out.size(),
+                               arr_out.truncated() || w.truncated()};
+    return result;
+}
+
+/**
+ * Write the representation of `x` through the output iterator `it`.
+ *
+ * Returns the iterator past the last character written.
+ */
+template <typename OutputIt, typename T,
+          typename = decltype(*std::declval<OutputIt&>()++ = 'x')>
+OutputIt repr_into(OutputIt it, const T& x,
+                   const repr_options& options = repr_options())
+{
+    repr_impl::iterator_output<OutputIt> it_out(it);
+    repr_impl::writer w(it_out, options);
+    repr_impl::repr_stream(w, x);
+    w.finish();
+    return it_out.finish();
+}
+
+#ifdef REPR_POSIX_IO
+/**
+ * Write the representation of `x` to the file descriptor `fd`.
+ *
+ * The text is written in chunks as it is rendered, so memory use doesn't grow
+ * with its size; long strings and other large blocks are written straight
+ * from where they are. Returns false if writing failed, with `errno` telling
+ * why; part of the text may have been written by then.
+ */
+template <typename T>
+bool repr_to_fd(int fd, const T& x,
+                const repr_options& options = repr_options())
+{
+    repr_impl::fd_output fd_out(fd);
+    repr_impl::writer w(fd_out, options);
+    repr_impl::repr_stream(w, x);
+    w.finish();
+    fd_out.finish();
+    return !fd_out.failed();
+}
+
+/**
+ * Write the representation of `x` to the file at `path`, replacing its
+ * contents, like `repr_to_fd()`. Returns false if the file couldn't be opened
+ * or written.
+ */
+template <typename T>
+bool repr_to_file(const std::string& path, const T& x,
+                  const repr_options& options = repr_options())
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0666);
+    if (fd < 0)
+        return false;
+
+    bool written = repr_to_fd(fd, x, options);
+    int error = errno;
+    bool closed = ::close(fd) == 0;
+
+    if (!written)
+        errno = error;
+    return written && closed;
+}
+#endif
+
+template <typename T>
+std::string repr(const T& x, const repr_options& options = repr_options())
+{
+    std::string result;
+    repr_into(result, x, options);
+    return result;
+}
+
+/**
+ * Reference to a value which is rendered only once the proxy is written to a
+ * `std::ostream` or `llvm::raw_ostream`, or converted to a string. Made by
+ * `repr_lazy()`.
+ *
+ * Streams get the text directly, without building a string first.
+ */
+template <typename T> class repr_proxy
+{
+  public:
+    repr_proxy(const T& x, const repr_options& options)
+        : x_(&x), options_(options)
+    {
+    }
+
+    std::string str() const { return repr(*x_, options_); }
+
+    operator std::string() const { return str(); }
+
+    /// Write the representation to `stream`.
+    template <typename Stream> void write_to(Stream& stream) const
+    {
+        repr_impl::stream_output<Stream> out(stream);
+        repr_impl::writer w(out, options_);
+        repr_impl::repr_stream(w, *x_);
+        w.finish();
+        out.finish();
+    }
+
+  private:
+    const T* x_;
+    repr_options options_;
+};
+
+/**
+ * Representation of `x` that is only rendered when it's used, e.g. in
+ * `LOG(debug) << repr_lazy(x)` with debug logging turned off. `x` has to
+ * outlive the proxy.
+ */
+template <typename T>
+repr_proxy<T> repr_lazy(const T& x,
+                        const repr_options& options = repr_options())
+{
+    return repr_proxy<T>(x, options);
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& stream, const repr_proxy<T>& proxy)
+{
+    proxy.write_to(stream);
+    return stream;
+}
+
+#ifdef ENABLE_REPR_LLVM
+template <typename T>
+llvm::raw_ostream& operator<<(llvm::raw_ostream& stream,
+                              const repr_proxy<T>& proxy)
+{
+    proxy.write_to(stream);
+    return stream;
+}
+#endif
+
+namespace repr_impl
+{
+using std::enable_if;
+using std::is_function;
+using std::is_same;
+using std::remove_cv;
+using std::remove_extent;
+using std::remove_reference;
+
+#ifdef ENABLE_REPR_LLVM
+struct debug_info {
+    std::string name = "";
+    std::string file = "";
+    int line_number = -1;
+    int column_number = -1;
+};
+
+// source location of an instruction, from its !dbg metadata
+inline void find_debug_location(const llvm::Instruction& instr,
+                                debug_info* dinfo)
+{
+    using namespace llvm;
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6
+    // by kind ID; looking up "dbg" would modify the LLVMContext
+    MDNode* mdata = instr.getMetadata(LLVMContext::MD_dbg);
+
+#if LLVM_VERSION_MINOR == 6
+    DILocation diloc_val(mdata);
+    DILocation* dloc = &diloc_val;
+#else
+    DILocation* dloc = dyn_cast_or_null<DILocation>(mdata);
+#endif
+
+    if (dloc) {
+#if LLVM_VERSION_MINOR == 6
+        dinfo->line_number = dloc->getLineNumber();
+        dinfo->column_number = dloc->getColumnNumber();
+        DIScope discope_val(dloc->getScope());
+        DIScope* discope = &discope_val;
+#else
+        dinfo->line_number = dloc->getLine();
+        dinfo->column_number = dloc->getColumn();
+        DIScope* discope = dyn_cast_or_null<DIScope>(dloc->getScope());
+#endif
+
+        if (discope != nullptr) {
+            std::string fname = discope->getFilename().str();
+            if (fname.size() > 0)
+                dinfo->file = std::move(fname);
+        }
+    }
+#else
+    (void)instr;
+    (void)dinfo;
+#endif
+}
+
+// If `instr` is a call to llvm.dbg.value, find the value it describes (or
+// nullptr if that is unknown) and the name of the variable holding it.
+inline bool find_dbg_value(const llvm::Instruction& instr,
+                           const llvm::Value** value, std::string* name)
+{
+    using namespace llvm;
+    auto* as_call = dyn_cast<CallInst>(&instr);
+
+    if (as_call == nullptr)
+        return false;
+
+    auto* func = as_call->getCalledFunction();
+    if (func == nullptr || func->getName() != "llvm.dbg.value")
+        return false;
+
+    *value = nullptr;
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR <= 5
+    // LLVM <= 3.5 has metadata within the same hierarchy as Values
+    MDNode* var = dyn_cast<MDNode>(as_call->getOperand(0));
+    *value = var->getOperand(0);
+
+    DIVariable divar(dyn_cast<MDNode>(as_call->getOperand(2)));
+    *name = divar.getName().str();
+#else
+    auto* meta0 =
+        dyn_cast<MetadataAsValue>(as_call->getOperand(0))->getMetadata();
+
+    if (auto* as_vam = dyn_cast_or_null<ValueAsMetadata>(meta0))
+        *value = as_vam->getValue();
+
+    auto* meta2 =
+        dyn_cast<MetadataAsValue>(as_call->getOperand(2))->getMetadata();
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 6
+    DIVariable divar(dyn_cast<MDNode>(meta2));
+    *name = divar.getName().str();
+#else
+    // from LLVM 3.7 onwards DIVariable inherits from MDNode
+    auto* divar = dyn_cast_or_null<DIVariable>(meta2);
+    *name = divar ? divar->getName().str() : std::string();
+#endif
+#endif
+
+    return true;
+}
+
+inline void find_debug_info(const llvm::Value& val, debug_info* dinfo)
+{
+    using namespace llvm;
+    auto* instr_ptr = dyn_cast<Instruction>(&val);
+
+    if (instr_ptr == nullptr || instr_ptr->getParent() == nullptr)
+        return;
+
+    find_debug_location(*instr_ptr, dinfo);
+
+    // to find the variable name try to locate a call to llvm.dbg.value in the
+    // same BB with this value as argument
+    for (auto& other_instr : *instr_ptr->getParent()) {
+        const Value* value;
+        std::string name;
+
+        if (find_dbg_value(other_instr, &value, &name) && value == instr_ptr &&
+            name.size() > 0)
+            dinfo->name = std::move(name);
+    }
+}
+
+// debug info of a basic block: the location of its first instruction that has
+// one
+inline void find_block_debug_info(const llvm::BasicBlock& bb,
+                                  debug_info* dinfo)
+{
+    for (auto& inst : bb) {
+        find_debug_location(inst, dinfo);
+        if (dinfo->line_number > 0)
+            break;
+    }
+}
+
+/**
+ * Debug info of the instructions and basic blocks of LLVM functions.
+ *
+ * A function is indexed with a single pass over its instructions the first
+ * time one of its values is looked up, rather than searching a basic block
+ * for each value. The index has to be invalidated when a function is
+ * modified.
+ */
+class debug_index
+{
+  public:
+    /// Debug info of `val`, or nullptr if it's not part of a function.
+    const debug_info* find(const llvm::Value& val)
+    {
+        using namespace llvm;
+        const BasicBlock* bb = dyn_cast<BasicBlock>(&val);
+
+        if (auto* instr_ptr = dyn_cast<Instruction>(&val))
+            bb = instr_ptr->getParent();
+
+        if (bb == nullptr || bb->getParent() == nullptr)
+            return nullptr;
+
+        auto res = functions_.insert(
+            std::make_pair(bb->getParent(), std::unique_ptr<value_map>()));
+
+        if (res.second)
+            res.first->second = build(*bb->getParent());
+
+        const value_map& values = *res.first->second;
+        auto it = values.find(&val);
+        return it != values.end() ? &it->second : &none_;
+    }
+
+    void invalidate(const llvm::Function& func) { functions_.erase(&func); }
+
+    void invalidate() { functions_.clear(); }
+
+  private:
+    typedef std::unordered_map<const llvm::Value*, debug_info> value_map;
+
+    static std::unique_ptr<value_map> build(const llvm::Function& func)
+    {
+        std::unique_ptr<value_map> values(new value_map());
+
+        for (auto& bb : func) {
+            debug_info bb_info;
+            find_block_debug_info(bb, &bb_info);
+            if (bb_info.line_number > 0 || bb_info.file.size() > 0)
+                (*values)[&bb] = std::move(bb_info);
+
+            for (auto& inst : bb) {
+                debug_info loc;
+                find_debug_location(inst, &loc);
+
+                if (loc.line_number > 0 || loc.file.size() > 0) {
+                    debug_info& info = (*values)[&inst];
+                    info.file = std::move(loc.file);
+                    info.line_number = loc.line_number;
+                    info.column_number = loc.column_number;
+                }
+
+                // the last named llvm.dbg.value in the same block wins
+                const llvm::Value* value;
+                std::string name;
+                if (find_dbg_value(inst, &value, &name) && name.size() > 0) {
+                    auto* target = llvm::dyn_cast_or_null<llvm::Instruction>(
+                        const_cast<llvm::Value*>(value));
+
+                    if (target != nullptr && target->getParent() == &bb)
+                        (*values)[target].name = std::move(name);
+                }
+            }
+        }
+
+        return values;
+    }
+
+    std::unordered_map<const llvm::Function*, std::unique_ptr<value_map>>
+        functions_;
+    debug_info none_;
+};
+} // namespace repr_impl
+
+/**
+ * Caches for rendering many LLVM values, shared by the `repr()` calls that
+ * pass the session in `repr_options::llvm_session`.
+ *
+ * Besides the debug info index, the session keeps one `ModuleSlotTracker` per
+ * module (from LLVM 3.8 onwards), so that printing unnamed values doesn't
+ * number all the values of their function again each time.
+ *
+ * Call `invalidate()` after modifying the IR of a function whose values were
+ * rendered in the session, or of any function if that is unknown.
+ */
+class repr_llvm_session
+{
+  public:
+    repr_impl::debug_index& debug_index() { return debug_index_; }
+
+#ifdef REPR_LLVM_SLOT_TRACKER
+    /// Slot tracker for the values of `module`, created on first use.
+    llvm::ModuleSlotTracker& slot_tracker(const llvm::Module& module)
+    {
+        auto& tracker = slot_trackers_[&module];
+
+        // like Value::print(), number metadata only as functions need it
+        if (!tracker)
+            tracker.reset(new llvm::ModuleSlotTracker(&module, false));
+
+        return *tracker;
+    }
+#endif
+
+    void invalidate(const llvm::Function& func)
+    {
+        debug_index_.invalidate(func);
+#ifdef REPR_LLVM_SLOT_TRACKER
+        slot_trackers_.erase(func.getParent());
+#endif
+    }
+
+    void invalidate()
+    {
+        debug_index_.invalidate();
+#ifdef REPR_LLVM_SLOT_TRACKER
+        slot_trackers_.clear();
+#endif
+    }
+
+  private:
+    repr_impl::debug_index debug_index_;
+#ifdef REPR_LLVM_SLOT_TRACKER
+    std::unordered_map<const llvm::Module*,
+                       std::unique_ptr<llvm::ModuleSlotTracker>>
+        slot_trackers_;
+#endif
+};
+
+namespace repr_impl
+{
+/**
+ * `llvm::raw_ostream` writing to a `writer`, for printing LLVM objects
+ * without first collecting their whole text in a string.
+ */
+class raw_writer_ostream : public llvm::raw_ostream
+{
+  public:
+    explicit raw_writer_ostream(writer& out) : out_(out)
+    {
+        SetBuffer(buffer_, sizeof(buffer_));
+    }
+
+    ~raw_writer_ostream() override { flush(); }
+
+  private:
+    void write_impl(const char* data, std::size_t size) override
+    {
+        out_.write(data, size);
+        written_ += size;
+    }
+
+    uint64_t current_pos() const override { return written_; }
+
+    writer& out_;
+    uint64_t written_ = 0;
+    char buffer_[256];
+};
+
+// module containing `val`, or nullptr if it's not part of one
+inline const llvm::Module* module_of(const llvm::Value& val)
+{
+    using namespace llvm;
+    const Function* func = nullptr;
+
+    if (auto* instr_ptr = dyn_cast<Instruction>(&val)) {
+        if (instr_ptr->getParent() != nullptr)
+            func = instr_ptr->getParent()->getParent();
+    } else if (auto* bb_ptr = dyn_cast<BasicBlock>(&val)) {
+        func = bb_ptr->getParent();
+    } else if (auto* arg_ptr = dyn_cast<Argument>(&val)) {
+        func = arg_ptr->getParent();
+    } else if (auto* global_ptr = dyn_cast<GlobalValue>(&val)) {
+        return global_ptr->getParent();
+    }
+
+    return func ? func->getParent() : nullptr;
+}
+
+// Print an unnamed value. Within a session its slot numbers come from the
+// session's slot tracker.
+inline void print_llvm_value(writer& out, const llvm::Value& val)
+{
+    raw_writer_ostream raw(out);
+
+#ifdef REPR_LLVM_SLOT_TRACKER
+    repr_llvm_session* session = out.options().llvm_session;
+    const llvm::Module* module = session ? module_of(val) : nullptr;
+
+    if (module != nullptr)
+        val.print(raw, session->slot_tracker(*module));
+    else
+        raw << val;
+#else
+    raw << val;
+#endif
+}
+
+// Will print `(<name>@?<filename>:?<line_number>?)` depending on what
+// information is available, or do nothing if nothing is known.
+inline void repr_debug_loc(writer& out, const llvm::Value& val)
+{
+    using namespace llvm;
+    repr_llvm_session* session = out.options().llvm_session;
+    const debug_info* indexed =
+        session ? session->debug_index().find(val) : nullptr;
+    debug_info found;
+
+    if (indexed == nullptr) {
+        if (auto bb_ptr = dyn_cast<BasicBlock>(&val))
+            find_block_debug_info(*bb_ptr, &found);
+        else
+            find_debug_info(val, &found);
+    }
+
+    const debug_info& dinfo = indexed ? *indexed : found;
+    bool has_name = dinfo.name.size() > 0;
+    bool has_file = dinfo.file.size() > 0;
+    bool has_line_number = dinfo.line_number > 0;
+    const char* delayed_out = "";
+
+    if (!has_name && !has_file && !has_line_number)
+        return;
+
+    out.put('(');
+
+    if (has_name) {
+        out.write(dinfo.name);
+        delayed_out = "@";
+    }
+
+    if (has_file) {
+        out.write(delayed_out);
+        out.write(dinfo.file);
+        delayed_out = ":";
+    }
+
+    if (has_line_number) {
+        out.write(delayed_out);
+        write_decimal(out, dinfo.line_number);
+    }
+
+    out.put(')');
+}
+#endif
+
+/// Identity of a value in a `repr_render_cache`: its address and type.
+struct cache_key {
+    const void* address;
+    const void* type;
+
+    bool operator==(const cache_key& other) const
+    {
+        return address == other.address && type == other.type;
+    }
+};
+
+struct cache_key_hash {
+    std::size_t operator()(const cache_key& key) const
+    {
+        std::hash<const void*> hash;
+        return hash(key.address) * 31 + hash(key.type);
+    }
+};
+
+// an address unique to each type, without RTTI
+template <typename T> struct type_id {
+    static const char id;
+};
+
+template <typename T> const char type_id<T>::id = 0;
+
+template <typename T> cache_key key_of(const T& x)
+{
+    cache_key key = {static_cast<const void*>(std::addressof(x)),
+                     &type_id<T>::id};
+    return key;
+}
+
+/**
+ * The options that the text of a value depends on, which have to match for
+ * its cached text to be reused. `max_bytes` doesn't matter, as it's applied
+ * when the text is written out.
+ */
+struct cache_signature {
+    explicit cache_signature(const writer& out)
+    {
+        const repr_options& options = out.options();
+        float_precision = options.float_precision;
+        levels = options.max_depth == 0
+                     ? std::numeric_limits<std::size_t>::max()
+                     : options.max_depth - out.depth();
+        max_elements = options.max_elements;
+        tail_elements = options.tail_elements;
+        escape = options.escape;
+        byte_format = options.byte_format;
+        json = options.json;
+    }
+
+    /**
+     * Whether text rendered for `out` can be cached at all. With
+     * `track_pointers` it depends on what was rendered before, and with
+     * `line_width` on the column it starts at.
+     */
+    static bool cacheable(const writer& out)
+    {
+        return !out.options().track_pointers && out.options().line_width == 0;
+    }
+
+    bool operator==(const cache_signature& other) const
+    {
+        return float_precision == other.float_precision &&
+               levels == other.levels && max_elements == other.max_elements &&
+               tail_elements == other.tail_elements &&
+               escape == other.escape && byte_format == other.byte_format &&
+               json == other.json;
+    }
+
+    int float_precision;
+    std::size_t levels;
+    std::size_t max_elements;
+    std::size_t tail_elements;
+    repr_escape escape;
+    repr_byte_format byte_format;
+    bool json;
+};
+
+/// A value with its version, made by `repr_cached()`.
+template <typename T> struct cached_value {
+    const T* value;
+    std::uint64_t version;
+};
+} // namespace repr_impl
+
+/**
+ * Cache of the text of values rendered through `repr_cached()`, shared by the
+ * `repr()` calls that pass it in `repr_options::render_cache`. A value whose
+ * text is in the cache is written out with a copy instead of being rendered
+ * again, wherever it appears.
+ *
+ * Values are identified by their address and type, and their text is reused
+ * for as long as the version passed to `repr_cached()` stays the same (and it
+ * is rendered with the same options). Bump the version, or call
+ * `invalidate()`, after modifying a value; e.g. for an `llvm::Function`,
+ * after modifying its IR. The least recently used texts are dropped once they
+ * take up more than `max_bytes` in total.
+ *
+ * Renders with `repr_options::track_pointers` or `line_width` don't use the
+ * cache. It must not be used by several threads at once; `repr_parallel()`
+ * renders serially with a cache.
+ */
+class repr_render_cache
+{
+  public:
+    explicit repr_render_cache(std::size_t max_bytes = 1 << 20)
+        : max_bytes_(max_bytes)
+    {
+    }
+
+    repr_render_cache(const repr_render_cache&) = delete;
+    repr_render_cache& operator=(const repr_render_cache&) = delete;
+
+    /// Drop the text of `x`, as passed to `repr_cached()`.
+    template <typename T> void invalidate(const T& x)
+    {
+        auto it = index_.find(repr_impl::key_of(x));
+        if (it != index_.end())
+            erase(it);
+    }
+
+    /// Drop everything.
+    void invalidate()
+    {
+        entries_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+    /// Number of values whose text is kept.
+    std::size_t size() const { return entries_.size(); }
+
+    /// Bytes of text kept.
+    std::size_t bytes() const { return bytes_; }
+
+    /// How many times text was reused from the cache.
+    std::size_t hits() const { return hits_; }
+
+    /// How many times a value had to be rendered.
+    std::size_t misses() const { return misses_; }
+
+    /**
+     * Cached text of the value `key` at `version` rendered with `signature`,
+     * or nullptr. Text of another version is dropped.
+     */
+    const std::string* find(const repr_impl::cache_key& key,
+                            std::uint64_t version,
+                            const repr_impl::cache_signature& signature)
+    {
+        auto it = index_.find(key);
+
+        if (it != index_.end()) {
+            entry& e = *it->second;
+
+            if (e.version == version && e.signature == signature) {
+                entries_.splice(entries_.begin(), entries_, it->second);
+                ++hits_;
+                return &e.text;
+            }
+
+            erase(it);
+        }
+
+        ++misses_;
+        return nullptr;
+    }
+
+    /// Keep `text` as the text of `key`, dropping the oldest texts if needed.
+    void insert(const repr_impl::cache_key& key, std::uint64_t version,
+                const repr_impl::cache_signature& signature, std::string text)
+    {
+        auto it = index_.find(key);
+        if (it != index_.end())
+            erase(it);
+
+        if (text.size() > max_bytes_)
+            return;
+
+        bytes_ += text.size();
+        entry e = {key, version, signature, std::move(text)};
+        entries_.push_front(std::move(e));
+        index_[key] = entries_.begin();
+
+        while (bytes_ > max_bytes_)
+            erase(index_.find(entries_.back().key));
+    }
+
+  private:
+    struct entry {
+        repr_impl::cache_key key;
+        std::uint64_t version;
+        repr_impl::cache_signature signature;
+        std::string text;
+    };
+
+    // most recently used first
+    typedef std::list<entry> entry_list;
+    typedef std::unordered_map<repr_impl::cache_key, entry_list::iterator,
+                               repr_impl::cache_key_hash>
+        entry_index;
+
+    void erase(entry_index::iterator it)
+    {
+        bytes_ -= it->second->text.size();
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+
+    std::size_t max_bytes_;
+    std::size_t bytes_ = 0;
+    std::size_t hits_ = 0;
+    std::size_t misses_ = 0;
+    entry_list entries_;
+    entry_index index_;
+};
+
+/**
+ * `x` rendered through `repr_options::render_cache`, reusing the text it had
+ * for the same `version` if there is one. Without a cache it's rendered like
+ * `x`. `x` has to outlive the result.
+ */
+template <typename T>
+repr_impl::cached_value<T> repr_cached(const T& x, std::uint64_t version = 0)
+{
+    repr_impl::cached_value<T> result = {&x, version};
+    return result;
+}
+
+namespace repr_impl
+{
+/**
+ * Kinds of values, one for each of the `repr_stream` overloads below.
+ *
+ * Each overload returns the tag of its category, so the category a type falls
+ * into can be found at compile time with `category_of<T>`.
+ */
+enum class category {
+    custom,
+    cached,
+    function,
+    string,
+    pointer,
+    iterator,
+    llvm_value,
+    bytes,
+    tuple,
+    number,
+    ostream,
+    map,
+    chars,
+    iterable,
+    llvm_raw,
+    other,
+    captured
+};
+
+constexpr std::size_t category_count =
+    static_cast<std::size_t>(category::captured) + 1;
+
+template <category c> using category_tag = std::integral_constant<category, c>;
+
+/**
+ * Dummy struct used to resolve ambiguous function overloads.
+ *
+ * If `overload_priority<0>()` is passed as an argument to a function, the
+ * overloads with a formal argument of type `overload_priority<n>` will be
+ * preferred for the smallest `n`. This helps to reduce guards in SFINAE-like
+ * template hacks.
+ */
+template <int n> struct overload_priority : public overload_priority<n + 1> {
+};
+
+template <> struct overload_priority<100> {
+};
+
+// render a nested value in place, trimmed like a separate repr() call
+template <typename T> void repr_nested(writer& out, const T& x)
+{
+    writer::element elem = out.begin_element();
+    repr_stream(out, x);
+    out.end_element(elem);
+}
+
+/**
+ * Counts one level of container nesting for as long as it lives.
+ *
+ * If the container is nested too deeply (see `repr_options::max_depth`) the
+ * level is not entered and the container should be written as `...`.
+ */
+class depth_guard
+{
+  public:
+    explicit depth_guard(writer& out) : out_(out), entered_(out.enter()) {}
+
+    ~depth_guard()
+    {
+        if (entered_)
+            out_.leave();
+    }
+
+    bool exceeded() const { return !entered_; }
+
+  private:
+    writer& out_;
+    bool entered_;
+};
+
+/// Element count that can't be known without going over all elements.
+const std::size_t unknown_count = static_cast<std::size_t>(-1);
+
+// "<N more>" in place of elided elements, or "..." if N isn't known
+inline void write_elided(writer& out, std::size_t count)
+{
+    if (count == unknown_count) {
+        out.write("...", 3);
+    } else {
+        out.put('<');
+        write_decimal(out, count);
+        out.write(" more>", 6);
+    }
+}
+
+// opening bracket of a container, map or tuple, which starts a group for
+// line breaking
+inline void open_group(writer& out, char bracket)
+{
+    out.begin_group();
+    out.put(bracket);
+}
+
+// closing bracket; the line can be broken before it if there were elements
+inline void close_group(writer& out, char bracket, bool any)
+{
+    if (any)
+        out.line_break("", 0, true);
+
+    out.put(bracket);
+    out.end_group();
+}
+
+// ", " before an element but the first one, where the line can be broken
+inline void write_separator(writer& out, bool first)
+{
+    if (first) {
+        out.line_break("", 0);
+    } else {
+        out.put(',');
+        out.line_break(" ", 1);
+    }
+}
+
+// elided elements of a container or tuple, or "..." for all of them if it's
+// nested too deep; a string of its own in JSON
+inline void write_elided_element(writer& out, std::size_t count)
+{
+    bool json = out.options().json;
+
+    if (json)
+        out.put('"');
+
+    write_elided(out, count);
+
+    if (json)
+        out.put('"');
+}
+
+// closing quote of a string, and how much of it was elided (if any): after
+// the quote, or inside it in JSON
+inline void end_string(writer& out, std::size_t elided)
+{
+    bool json = out.options().json;
+
+    if (!json)
+        out.put('"');
+
+    if (elided != 0)
+        write_elided(out, elided);
+
+    if (json)
+        out.put('"');
+}
+
+// number of elements of `xs`, if known without going over them
+template <typename T>
+auto container_size(const T& xs, overload_priority<0>)
+    -> decltype(static_cast<std::size_t>(xs.size()))
+{
+    return static_cast<std::size_t>(xs.size());
+}
+
+template <typename T>
+std::size_t container_size(const T&, overload_priority<1>)
+{
+    return unknown_count;
+}
+
+/**
+ * Trait for testing whether an iterator declares itself as random-access.
+ */
+template <typename It, typename = void>
+struct is_random_access : std::false_type {
+};
+
+template <typename It>
+struct is_random_access<
+    It, typename enable_if<std::is_base_of<
+            std::random_access_iterator_tag,
+            typename std::iterator_traits<It>::iterator_category>::value>::type>
+    : std::true_type {
+};
+
+// after the first `limit` elements: skip to the last `tail_elements` ones
+template <typename T, typename It, typename F>
+void for_each_shown_tail(const writer& out, const T& xs, It it, std::size_t,
+                         F& f, std::true_type)
+{
+    It end = xs.end();
+    std::size_t rest = static_cast<std::size_t>(end - it);
+    std::size_t tail = std::min(out.options().tail_elements, rest);
+
+    if (tail < rest)
+        f.elided(rest - tail);
+
+    for (it = end - tail; it != end && !out.done(); ++it)
+        f(*it);
+}
+
+template <typename T, typename It, typename F>
+void for_each_shown_tail(const writer&, const T& xs, It, std::size_t limit,
+                         F& f, std::false_type)
+{
+    std::size_t size = container_size(xs, overload_priority<0>());
+    f.elided(size == unknown_count ? size : size - limit);
+}
+
+/**
+ * Call `f(x)` for the elements `x` of `xs` within the element budget and
+ * `f.elided(n)` once in place of the `n` elements which are not, stopping
+ * early when `out` is done. See `repr_options::max_elements`.
+ *
+ * Only the elements within the budget are visited, except for counting the
+ * rest of containers that don't know their size.
+ */
+template <typename T, typename F>
+void for_each_shown(const writer& out, const T& xs, F& f)
+{
+    std::size_t limit = out.options().max_elements;
+    std::size_t shown = 0;
+    auto it = xs.begin();
+    auto end = xs.end();
+
+    for (; it != end; ++it, ++shown) {
+        if (out.done())
+            return;
+
+        if (shown == limit && limit != 0) {
+            for_each_shown_tail(out, xs, it, limit, f,
+                                is_random_access<decltype(it)>());
+            return;
+        }
+
+        f(*it);
+    }
+}
+
+/// Comma-separated list of elements; see `for_each_shown()`.
+class list_writer
+{
+  public:
+    explicit list_writer(writer& out) : out_(out) {}
+
+    void separator()
+    {
+        write_separator(out_, !needs_comma_);
+        needs_comma_ = true;
+    }
+
+    /// Whether there were any elements.
+    bool any() const { return needs_comma_; }
+
+    void elided(std::size_t count)
+    {
+        separator();
+        write_elided_element(out_, count);
+    }
+
+  protected:
+    writer& out_;
+
+  private:
+    bool needs_comma_ = false;
+};
+
+/// Elements of an iterable, possibly in `<...>` brackets.
+class element_writer : public list_writer
+{
+  public:
+    element_writer(writer& out, bool brackets)
+        : list_writer(out), brackets_(brackets)
+    {
+    }
+
+    template <typename T> void operator()(const T& x)
+    {
+        separator();
+
+        if (brackets_)
+            out_.put('<');
+
+        repr_nested(out_, x);
+
+        if (brackets_)
+            out_.put('>');
+    }
+
+    void set_brackets(bool brackets) { brackets_ = brackets; }
+
+  private:
+    bool brackets_;
+};
+
+/// `key: value` entries of a map, or `[key, value]` pairs in JSON unless the
+/// keys are strings.
+class map_entry_writer : public list_writer
+{
+  public:
+    map_entry_writer(writer& out, bool pairs) : list_writer(out), pairs_(pairs)
+    {
+    }
+
+    template <typename T> void operator()(const T& x)
+    {
+        separator();
+
+        if (pairs_)
+            out_.put('[');
+
+        repr_nested(out_, x.first);
+        out_.write(pairs_ ? ", " : ": ", 2);
+        repr_nested(out_, x.second);
+
+        if (pairs_)
+            out_.put(']');
+    }
+
+    void elided(std::size_t count)
+    {
+        list_writer::elided(count);
+
+        // the "<N more>" is a key
+        if (!pairs_ && out_.options().json)
+            out_.write(": null", 6);
+    }
+
+  private:
+    bool pairs_;
+};
+
+template <typename T, std::size_t n> struct tuple_repr {
+    void operator()(writer& out, const T& tuple)
+    {
+        tuple_repr<T, n - 1>()(out, tuple);
+
+        std::size_t limit = out.options().max_elements;
+        std::size_t index = n - 1;
+
+        if (out.done() || (limit != 0 && index > limit))
+            return;
+
+        write_separator(out, n == 1);
+
+        if (limit != 0 && index == limit)
+            write_elided_element(out, std::tuple_size<T>::value - limit);
+        else
+            repr_nested(out, std::get<n - 1>(tuple));
+    }
+};
+
+template <typename T> struct tuple_repr<T, 0> {
+    void operator()(writer&, const T&) {}
+};
+
+/**
+ * Trait for testing whether a type is a C-style string, std::string or a view
+ * of a string (std::string_view, llvm::StringRef).
+ */
+template <typename T> struct is_string_like {
+    static const bool value =
+        is_same<T, char*>::value || is_same<T, const char*>::value ||
+        is_same<typename remove_extent<T>::type, char>::value ||
+        is_same<typename remove_extent<T>::type, const char>::value ||
+        is_same<T, std::string>::value
+#ifdef REPR_STRING_VIEW
+        || is_same<T, std::string_view>::value
+#endif
+#ifdef ENABLE_REPR_LLVM
+        || is_same<T, llvm::StringRef>::value
+#endif
+        ;
+};
+
+/**
+ * Trait for testing whether a type is a number or a boolean that is printed
+ * as such (or `true`/`false`) rather than as a character.
+ */
+template <typename T> struct is_plain_number {
+    static const bool value =
+        std::is_arithmetic<T>::value && !is_same<T, char>::value &&
+        !is_same<T, signed char>::value && !is_same<T, unsigned char>::value;
+};
+
+/**
+ * Trait for testing whether an iterator can be used to go over a range more
+ * than once. Iterators that don't declare their category are assumed not to.
+ */
+template <typename It, typename = void> struct is_multipass : std::false_type {
+};
+
+template <typename It>
+struct is_multipass<
+    It, typename enable_if<std::is_base_of<
+            std::forward_iterator_tag,
+            typename std::iterator_traits<It>::iterator_category>::value>::type>
+    : std::true_type {
+};
+
+/**
+ * Unimplemented function that provides a value of a given type.
+ *
+ * This function cannot be called but it can be used in `decltype(...)` to get
+ * a type of expressions using values of a given type.
+ */
+template <typename T> T val();
+
+/**
+ * Trait for testing whether a type is a byte, rendered in hex as part of a
+ * byte buffer.
+ */
+template <typename T> struct is_byte {
+    static const bool value = is_same<T, unsigned char>::value
+#if __cplusplus >= 201703L
+                              || is_same<T, std::byte>::value
+#endif
+        ;
+};
+
+/**
+ * Trait for testing whether a container of bytes keeps them in one block,
+ * which `data()` points to.
+ */
+template <typename T, typename = void>
+struct is_contiguous_bytes : std::false_type {
+};
+
+template <typename T>
+struct is_contiguous_bytes<
+    T, typename enable_if<
+           is_byte<typename remove_cv<typename std::remove_pointer<decltype(
+               val<const T&>().data())>::type>::type>::value &&
+           std::is_integral<decltype(val<const T&>().size())>::value>::type>
+    : std::true_type {
+};
+
+/**
+ * Trait for testing whether a container keeps its chars in one block, which
+ * `data()` points to, so that they can be written at once.
+ */
+template <typename T, typename = void>
+struct is_contiguous_chars : std::false_type {
+};
+
+template <typename T>
+struct is_contiguous_chars<
+    T, typename enable_if<
+           std::is_convertible<decltype(val<const T&>().data()),
+                               const char*>::value &&
+           std::is_integral<decltype(val<const T&>().size())>::value>::type>
+    : std::true_type {
+};
+
+// user types with a `repr_append()` overload (see `repr_writer`); they come
+// first so that they don't fall into any of the categories below
+template <typename T,
+          typename = decltype(repr_append(val<writer&>(), val<const T&>())),
+          typename = typename enable_if<!is_function<T>::value>::type>
+category_tag<category::custom>
+repr_stream(writer& out, const T& x, overload_priority<0>)
+{
+    repr_append(out, x);
+    return {};
+}
+
+// values wrapped in `repr_cached()`, copied from the cache if possible
+template <typename T>
+category_tag<category::cached>
+repr_stream(writer& out, const cached_value<T>& x, overload_priority<0>)
+{
+    repr_render_cache* cache = out.options().render_cache;
+
+    if (cache == nullptr || !cache_signature::cacheable(out)) {
+        repr_stream(out, *x.value);
+        return {};
+    }
+
+    cache_key key = key_of(*x.value);
+    cache_signature signature(out);
+
+    if (const std::string* text = cache->find(key, x.version, signature)) {
+        out.write(*text);
+        return {};
+    }
+
+    std::string text;
+    string_output text_out(&text);
+
+    {
+        writer w(text_out, out, out.probing());
+        repr_stream(w, *x.value);
+        w.finish();
+    }
+
+    text_out.finish();
+    out.write(text);
+    cache->insert(key, x.version, signature, std::move(text));
+    return {};
+}
+
+// function type (NOT std::function)
+// Has to come before pointers as function types are infinitely-dereferencable
+// pointer-like things.
+template <typename T,
+          typename = typename enable_if<is_function<T>::value>::type>
+category_tag<category::function>
+repr_stream(writer& out, const T& x, overload_priority<0>)
+{
+    out.write("<function@");
+    write_address(out, reinterpret_cast<std::uintptr_t>(&x));
+    out.put('>');
+    return {};
+}
+
+// escape sequence for a character found by `find_escape()`
+inline void write_escape(writer& out, char c, repr_escape escape)
+{
+    const char* named = nullptr;
+
+    switch (c) {
+    case '"':
+        named = "\\\"";
+        break;
+    case '\\':
+        named = "\\\\";
+        break;
+    case '\n':
+        named = "\\n";
+        break;
+    case '\t':
+        named = "\\t";
+        break;
+    case '\r':
+        named = "\\r";
+        break;
+    case '\b':
+        named = "\\b";
+        break;
+    case '\f':
+        named = "\\f";
+        break;
+    }
+
+    if (named != nullptr) {
+        out.write_verbatim(named, 2);
+        return;
+    }
+
+    unsigned char u = static_cast<unsigned char>(c);
+    char buf[6];
+
+    if (escape == repr_escape::json) {
+        // DEL doesn't have to be escaped in JSON
+        if (u == 0x7f) {
+            out.write_verbatim(&c, 1);
+            return;
+        }
+
+        const char* digits = "0123456789abcdef";
+        std::memcpy(buf, "\\u00", 4);
+        buf[4] = digits[u >> 4];
+        buf[5] = digits[u & 15];
+        out.write_verbatim(buf, 6);
+    } else {
+        // octal rather than \x, which would swallow hex digits that follow
+        buf[0] = '\\';
+        buf[1] = static_cast<char>('0' + (u >> 6));
+        buf[2] = static_cast<char>('0' + ((u >> 3) & 7));
+        buf[3] = static_cast<char>('0' + (u & 7));
+        out.write_verbatim(buf, 4);
+    }
+}
+
+// contents of a quoted string, escaped as set in the options
+inline void write_string_data(writer& out, const char* data, std::size_t size)
+{
+    repr_escape escape =
+        out.options().json ? repr_escape::json : out.options().escape;
+
+    if (escape == repr_escape::raw) {
+        out.write_verbatim(data, size);
+        return;
+    }
+
+    while (size != 0) {
+        std::size_t clean = find_escape(data, size);
+        out.write_verbatim(data, clean);
+
+        if (clean == size)
+            break;
+
+        write_escape(out, data[clean], escape);
+        data += clean + 1;
+        size -= clean + 1;
+    }
+}
+
+// quoted string, with at most `max_elements` characters
+inline void write_string(writer& out, const char* data, std::size_t size)
+{
+    std::size_t limit = out.options().max_elements;
+    std::size_t shown = limit != 0 ? std::min(size, limit) : size;
+
+    out.put('"');
+    write_string_data(out, data, shown);
+    end_string(out, size - shown);
+}
+
+inline void string_data(const char* x, const char** data, std::size_t* size)
+{
+    *data = x;
+    *size = std::strlen(x);
+}
+
+inline void string_data(const std::string& x, const char** data,
+                        std::size_t* size)
+{
+    *data = x.data();
+    *size = x.size();
+}
+
+inline void string_data(const char& x, const char** data, std::size_t* size)
+{
+    *data = &x;
+    *size = 1;
+}
+
+#ifdef REPR_STRING_VIEW
+inline void string_data(std::string_view x, const char** data,
+                        std::size_t* size)
+{
+    *data = x.data();
+    *size = x.size();
+}
+#endif
+
+#ifdef ENABLE_REPR_LLVM
+inline void string_data(llvm::StringRef x, const char** data,
+                        std::size_t* size)
+{
+    *data = x.data();
+    *size = x.size();
+}
+#endif
+
+// string-like: char*, const char*, char[], std::string and string views
+template <typename T,
+          typename = typename enable_if<is_string_like<T>::value>::type>
+category_tag<category::string>
+repr_stream(writer& out, const T& x, overload_priority<1>)
+{
+    const char* data;
+    std::size_t size;
+    string_data(x, &data, &size);
+    write_string(out, data, size);
+    return {};
+}
+
+// Byte buffers are written in blocks, as bytes that fit into the buffers below.
+const std::size_t byte_block = 256;
+
+// whether byte buffers are written as hex strings; dumps aren't JSON
+inline bool hex_bytes(const writer& out)
+{
+    return out.options().byte_format == repr_byte_format::hex ||
+           out.options().json;
+}
+
+inline void write_hex_bytes(writer& out, const unsigned char* data,
+                            std::size_t size)
+{
+    char digits[2 * byte_block];
+
+    for (std::size_t done = 0; done < size && !out.done();) {
+        std::size_t block = std::min(size - done, byte_block);
+        hex_encode(data + done, block, digits);
+        out.write_verbatim(digits, 2 * block);
+        done += block;
+    }
+}
+
+// one line of a dump, with up to 16 bytes found at `offset` in the buffer
+inline void write_dump_line(writer& out, const unsigned char* data,
+                            std::size_t size, std::size_t offset)
+{
+    char line[96];
+    char* pos = line;
+
+    if (offset != 0)
+        *pos++ = '\n';
+
+    unsigned char where[sizeof(std::size_t)];
+    std::size_t where_size = 0;
+
+    for (std::size_t x = offset; where_size < 4 || x != 0; x >>= 8)
+        where[sizeof(where) - ++where_size] = static_cast<unsigned char>(x);
+
+    hex_encode(where + sizeof(where) - where_size, where_size, pos);
+    pos += 2 * where_size;
+
+    char digits[32];
+    hex_encode(data, size, digits);
+
+    for (std::size_t i = 0; i < 16; ++i) {
+        *pos++ = ' ';
+        if (i % 8 == 0)
+            *pos++ = ' ';
+
+        pos[0] = i < size ? digits[2 * i] : ' ';
+        pos[1] = i < size ? digits[2 * i + 1] : ' ';
+        pos += 2;
+    }
+
+    *pos++ = ' ';
+    *pos++ = ' ';
+    *pos++ = '|';
+    for (std::size_t i = 0; i < size; ++i)
+        *pos++ = data[i] >= 0x20 && data[i] < 0x7f ? static_cast<char>(data[i])
+                                                     : '.';
+    *pos++ = '|';
+
+    out.write_verbatim(line, static_cast<std::size_t>(pos - line));
+}
+
+// bytes found at `offset` in a buffer, which is a multiple of 16 (the size
+// of a line of a dump) unless it's the last part of the buffer
+inline void write_bytes(writer& out, const unsigned char* data,
+                        std::size_t size, std::size_t offset)
+{
+    if (hex_bytes(out)) {
+        write_hex_bytes(out, data, size);
+        return;
+    }
+
+    for (std::size_t done = 0; done < size && !out.done(); done += 16) {
+        std::size_t line = std::min<std::size_t>(size - done, 16);
+        write_dump_line(out, data + done, line, offset + done);
+    }
+}
+
+inline void begin_bytes(writer& out, std::size_t size)
+{
+    if (out.options().json)
+        out.put('"');
+    else if (hex_bytes(out) || size == 0)
+        out.write("x\"", 2);
+}
+
+// finish a byte buffer with `size` bytes written and `elided` left out
+inline void end_bytes(writer& out, std::size_t size, std::size_t elided)
+{
+    if (hex_bytes(out) || size == 0) {
+        end_string(out, elided);
+        return;
+    }
+
+    if (elided != 0) {
+        out.write_verbatim("\n", 1);
+        write_elided(out, elided);
+    }
+}
+
+// byte buffer of `size` bytes, with at most `max_elements` of them; `size` is
+// only a lower bound unless the buffer is `sized`
+inline void write_byte_buffer(writer& out, const unsigned char* data,
+                              std::size_t size, bool sized = true)
+{
+    std::size_t limit = out.options().max_elements;
+    std::size_t shown = limit != 0 ? std::min(size, limit) : size;
+    std::size_t elided =
+        shown == size ? 0 : sized ? size - shown : unknown_count;
+
+    begin_bytes(out, shown);
+    write_bytes(out, data, shown, 0);
+    end_bytes(out, shown, elided);
+}
+
+// bytes kept in one block are written from there
+template <typename T>
+void write_byte_range(writer& out, const T& xs, std::true_type)
+{
+    write_byte_buffer(out, reinterpret_cast<const unsigned char*>(xs.data()),
+                      static_cast<std::size_t>(xs.size()));
+}
+
+// other bytes are gathered into blocks
+template <typename T>
+void write_byte_range(writer& out, const T& xs, std::false_type)
+{
+    std::size_t limit = out.options().max_elements;
+    unsigned char block[byte_block];
+    std::size_t pending = 0;
+    std::size_t shown = 0;
+    bool elided = false;
+
+    auto it = xs.begin();
+    auto end = xs.end();
+
+    begin_bytes(out, it == end ? 0 : 1);
+    for (; it != end; ++it) {
+        if (shown == limit && limit != 0) {
+            elided = true;
+            break;
+        }
+
+        block[pending++] = static_cast<unsigned char>(*it);
+        ++shown;
+
+        if (pending == byte_block) {
+            write_bytes(out, block, pending, shown - pending);
+            pending = 0;
+
+            if (out.done())
+                break;
+        }
+    }
+    write_bytes(out, block, pending, shown - pending);
+
+    std::size_t count = unknown_count;
+    if (elided) {
+        std::size_t size = container_size(xs, overload_priority<0>());
+        count = size == unknown_count ? size : size - shown;
+    }
+
+    end_bytes(out, shown, elided ? count : 0);
+}
+
+// byte buffers: containers of unsigned char (or std::byte), printed in hex
+template <typename T, typename = typename enable_if<is_byte<
+                          typename std::decay<decltype(
+                              *val<T>().begin())>::type>::value>::type>
+category_tag<category::bytes>
+repr_stream(writer& out, const T& xs, overload_priority<1>)
+{
+    write_byte_range(out, xs, is_contiguous_bytes<T>());
+    return {};
+}
+
+inline void write_null(writer& out)
+{
+    out.write(out.options().json ? "null" : "nullptr");
+}
+
+// render an object reached through a pointer, or refer to it if it was
+// rendered already
+template <typename T> void repr_pointee(writer& out, const T& x)
+{
+    node_tracker* nodes = out.nodes();
+
+    if (nodes == nullptr) {
+        repr_nested(out, x);
+        return;
+    }
+
+    node_tracker::visit visit = nodes->enter(x);
+
+    if (visit.id != 0 && out.options().json)
+        out.put('"');
+
+    if (visit.active && visit.id != 0) {
+        out.write("<cycle>", 7);
+    } else if (visit.id != 0) {
+        out.write("<ref#", 5);
+        write_decimal(out, visit.id);
+        out.put('>');
+    } else {
+        repr_nested(out, x);
+        nodes->leave(x);
+    }
+
+    if (visit.id != 0 && out.options().json)
+        out.put('"');
+}
+
+// nullptr itself, which can't be dereferenced
+template <typename T, typename = typename enable_if<
+                          std::is_same<T, std::nullptr_t>::value>::type>
+category_tag<category::pointer>
+repr_stream(writer& out, const T&, overload_priority<2>)
+{
+    write_null(out);
+    return {};
+}
+
+// pointers dumb and smart
+template <typename T, typename = decltype(*val<T>()),
+          typename = decltype(!val<T>())>
+category_tag<category::pointer>
+repr_stream(writer& out, const T& x, overload_priority<2>)
+{
+    if (!x)
+        write_null(out); // also includes some "false" iterators
+    else
+        repr_pointee(out, *x);
+    return {};
+}
+
+// iterators and smart pointers that don't support conversions to bool
+template <typename T, typename = decltype(*val<T>())>
+category_tag<category::iterator>
+repr_stream(writer& out, const T& x, overload_priority<3>)
+{
+    repr_pointee(out, *x);
+    return {};
+}
+
+#ifdef ENABLE_REPR_LLVM
+// all LLVM values
+template <typename T,
+          typename = decltype(repr_debug_loc(val<writer&>(), val<T&>()))>
+category_tag<category::llvm_value>
+repr_stream(writer& out, const T& x, overload_priority<4>)
+{
+    llvm::StringRef name = x.getName();
+
+    if (name.size() > 0)
+        out.write(name.data(), name.size());
+    else
+        print_llvm_value(out, x);
+
+    repr_debug_loc(out, x);
+    return {};
+}
+#endif
+
+// tuples and tuple-like things like std::pair and std::array
+template <typename T, typename = decltype(std::tuple_size<T>::value)>
+category_tag<category::tuple>
+repr_stream(writer& out, const T& x, overload_priority<5>)
+{
+    depth_guard guard(out);
+    if (guard.exceeded()) {
+        write_elided_element(out, unknown_count);
+        return {};
+    }
+
+    bool json = out.options().json;
+    open_group(out, json ? '[' : '(');
+    tuple_repr<T, std::tuple_size<T>::value>()(out, x);
+    close_group(out, json ? ']' : ')', std::tuple_size<T>::value > 0);
+    return {};
+}
+
+// numbers and booleans; formatted directly, without an ostream
+template <typename T,
+          typename = typename enable_if<is_plain_number<T>::value>::type>
+category_tag<category::number>
+repr_stream(writer& out, const T& x, overload_priority<6>)
+{
+    write_number(out, x);
+    return {};
+}
+
+// ostream-printable
+template <typename T, typename = decltype(std::cout << val<T>()),
+          typename = typename enable_if<!is_plain_number<T>::value>::type>
+category_tag<category::ostream>
+repr_stream(writer& out, const T& x, overload_priority<6>)
+{
+    out.stream() << x;
+    out.end_stream();
+    return {};
+}
+
+// whether the keys of a map are string-like, as those of JSON objects
+template <typename T> bool has_string_keys(const T&)
+{
+    return is_string_like<typename std::decay<decltype(
+        val<const T&>().begin()->first)>::type>::value;
+}
+
+// iterable (container) of pairs; print like a map
+template <typename T, typename = decltype(val<T>().begin()->first),
+          typename = decltype(val<T>().begin()->second)>
+category_tag<category::map>
+repr_stream(writer& out, const T& xs, overload_priority<7>)
+{
+    depth_guard guard(out);
+    if (guard.exceeded()) {
+        write_elided_element(out, unknown_count);
+        return {};
+    }
+
+    bool pairs = out.options().json && !has_string_keys(xs);
+    map_entry_writer entries(out, pairs);
+    open_group(out, pairs ? '[' : '{');
+    for_each_shown(out, xs, entries);
+    close_group(out, pairs ? ']' : '}', entries.any());
+    return {};
+}
+
+// chars kept in one block are written at once
+template <typename T>
+void write_chars(writer& out, const T& xs, std::true_type)
+{
+    write_string(out, xs.data(), static_cast<std::size_t>(xs.size()));
+}
+
+// other chars are gathered into chunks
+template <typename T>
+void write_chars(writer& out, const T& xs, std::false_type)
+{
+    std::size_t limit = out.options().max_elements;
+    std::size_t shown = 0;
+    bool elided = false;
+    char chunk[64];
+    std::size_t pending = 0;
+
+    out.put('"');
+    for (auto x : xs) {
+        if (shown == limit && limit != 0) {
+            elided = true;
+            break;
+        }
+
+        chunk[pending++] = x;
+        ++shown;
+
+        if (pending == sizeof(chunk)) {
+            write_string_data(out, chunk, pending);
+            pending = 0;
+
+            if (out.done())
+                break;
+        }
+    }
+    write_string_data(out, chunk, pending);
+
+    std::size_t count = 0;
+    if (elided) {
+        std::size_t size = container_size(xs, overload_priority<0>());
+        count = size == unknown_count ? size : size - shown;
+    }
+
+    end_string(out, count);
+}
+
+// iterable (container) of chars; print like a string
+// FIXME: ugly blob of template magic
+template <typename T,
+          typename = typename enable_if<is_same<
+              char, typename remove_cv<typename remove_reference<decltype(
+                        *(val<T>().begin()))>::type>::type>::value>::type>
+category_tag<category::chars>
+repr_stream(writer& out, const T& xs, overload_priority<8>)
+{
+    write_chars(out, xs, is_contiguous_chars<T>());
+    return {};
+}
+
+/// Whether the elements of a container need `<...>` around them.
+enum class bracketing { never, always, depends };
+
+/**
+ * Trait telling whether values of type `T` as container elements need
+ * bracketing, if that can be determined from the type alone.
+ *
+ * Defined after the `repr_stream` overloads, as it follows their dispatch.
+ */
+template <typename T> struct bracketing_of;
+
+template <typename T>
+struct element_bracketing
+    : bracketing_of<typename std::decay<decltype(*val<T>().begin())>::type> {
+};
+
+// JSON arrays don't need bracketing
+inline bracketing json_bracketing(const writer& out, bracketing known)
+{
+    return out.options().json ? bracketing::never : known;
+}
+
+// whether the elements of `xs` need bracketing, as far as known up front
+template <typename T> bracketing elements_bracketing(const T&)
+{
+    return element_bracketing<T>::value;
+}
+
+/**
+ * Checks whether any of the elements passed to it need bracketing, by
+ * rendering them without storing the text. Stops at the first one that does.
+ */
+class bracket_probe
+{
+  public:
+    explicit bracket_probe(const writer& parent)
+        : writer_(scan_, parent, true),
+          nodes_mark_(parent.nodes() ? parent.nodes()->mark() : 0)
+    {
+        // like the spooling of single-pass ranges, look no further than the
+        // byte budget reaches
+        scan_.set_limit(parent.remaining_bytes());
+    }
+
+    // the objects seen by the probe have yet to be rendered for real
+    ~bracket_probe()
+    {
+        if (writer_.nodes())
+            writer_.nodes()->rollback(nodes_mark_);
+    }
+
+    template <typename T> void operator()(const T& x)
+    {
+        scan_.reset();
+        repr_nested(writer_, x);
+
+        // one element needing brackets decides it for all of them
+        if (scan_.needs_brackets()) {
+            found_ = true;
+            scan_.stop();
+        }
+    }
+
+    void elided(std::size_t) {}
+
+    /// The writer to pass to `for_each_shown()`; done once `found()`.
+    const writer& probe() const { return writer_; }
+
+    bool found() const { return found_; }
+
+  private:
+    scan_output scan_;
+    writer writer_;
+    std::size_t nodes_mark_;
+    bool found_ = false;
+};
+
+// multi-pass range: decide on bracketing first, then write the elements out
+// as they are rendered
+template <typename T>
+void repr_iterable(writer& out, const T& xs, std::true_type)
+{
+    // inside a probe the brackets can't change the outcome; skip the extra pass
+    bracketing known = json_bracketing(out, elements_bracketing(xs));
+    bool brackets = known == bracketing::always;
+
+    if (known == bracketing::depends && !out.probing()) {
+        bracket_probe probe(out);
+        for_each_shown(probe.probe(), xs, probe);
+        brackets = probe.found();
+    }
+
+    element_writer elements(out, brackets);
+    open_group(out, '[');
+    for_each_shown(out, xs, elements);
+    close_group(out, ']', elements.any());
+}
+
+/**
+ * Elements of a single-pass range. They are spooled until it is known whether
+ * they need bracketing, and written out as they are rendered after that.
+ */
+class spooling_element_writer
+{
+  public:
+    spooling_element_writer(writer& out, bool decided, bool brackets)
+        : out_(out), spool_out_(&*spool_),
+          spool_writer_(spool_out_, out, false),
+          elements_(out, brackets), decided_(decided), brackets_(brackets)
+    {
+    }
+
+    template <typename T> void operator()(const T& x)
+    {
+        if (decided_) {
+            elements_(x);
+            return;
+        }
+
+        std::size_t start = spool_out_.size();
+        repr_nested(spool_writer_, x);
+        std::size_t end = spool_out_.size();
+        ends_->push_back(end);
+
+        if (needs_brackets(spool_->data() + start, end - start)) {
+            brackets_ = true;
+            write_spool();
+        } else if (end > out_.remaining_bytes()) {
+            write_spool(); // will be cut short anyway
+        }
+    }
+
+    void elided(std::size_t count)
+    {
+        write_spool();
+        elements_.elided(count);
+    }
+
+    bool any() const { return elements_.any(); }
+
+    /// Write out whatever is still spooled.
+    void write_spool()
+    {
+        if (decided_)
+            return;
+
+        std::size_t start = 0;
+        elements_.set_brackets(brackets_);
+
+        for (std::size_t end : *ends_) {
+            elements_.separator();
+
+            if (brackets_)
+                out_.put('<');
+
+            out_.write(spool_->data() + start, end - start);
+
+            if (brackets_)
+                out_.put('>');
+
+            start = end;
+        }
+
+        decided_ = true;
+    }
+
+  private:
+    writer& out_;
+    scratch<std::string> spool_;
+    string_output spool_out_;
+    writer spool_writer_;
+    scratch<std::vector<std::size_t>> ends_;
+    element_writer elements_;
+    bool decided_;
+    bool brackets_;
+};
+
+// single-pass range: elements can only be rendered once, so they are spooled
+// until the bracketing decision is known
+template <typename T>
+void repr_iterable(writer& out, const T& xs, std::false_type)
+{
+    // inside a probe the brackets can't change the outcome
+    bracketing known = json_bracketing(out, elements_bracketing(xs));
+    spooling_element_writer elements(out,
+                                     out.probing() ||
+                                         known != bracketing::depends,
+                                     known == bracketing::always);
+
+    open_group(out, '[');
+    for_each_shown(out, xs, elements);
+    elements.write_spool();
+    close_group(out, ']', elements.any());
+}
+
+// iterable
+template <typename T, typename = decltype(val<T>().begin())>
+category_tag<category::iterable>
+repr_stream(writer& out, const T& xs, overload_priority<9>)
+{
+    depth_guard guard(out);
+    if (guard.exceeded()) {
+        write_elided_element(out, unknown_count);
+        return {};
+    }
+
+    repr_iterable(out, xs, is_multipass<decltype(xs.begin())>());
+    return {};
+}
+
+#ifdef ENABLE_REPR_LLVM
+// other LLVM objects that can be printed to a raw_ostream
+template <typename T,
           typename = decltype(val<llvm::raw_ostream&>() << val<T>())>
-void repr_stream(std::ostream& out, const T& x, overload_priority<10>)
+category_tag<category::llvm_raw>
+repr_stream(writer& out, const T& x, overload_priority<10>)
+{
+    raw_writer_ostream raw(out);
+    raw << x;
+    return {};
+}
+#endif
+
+// other: just print the address
+template <typename T>
+category_tag<category::other>
+repr_stream(writer& out, const T& x, overload_priority<100>)
+{
+    out.put('<');
+    write_address(out, reinterpret_cast<std::uintptr_t>(std::addressof(x)));
+    out.put('>');
+    return {};
+}
+
+template <typename T>
+using category_of = decltype(
+    repr_stream(val<writer&>(), val<const T&>(), overload_priority<0>()));
+
+// whether values of a category are written as valid JSON in JSON mode
+constexpr bool has_json_form(category c)
+{
+    return c != category::custom && c != category::function &&
+           c != category::llvm_value &&
+           c != category::ostream && c != category::llvm_raw &&
+           c != category::other;
+}
+
+// text of a value as a JSON string
+template <typename T> void repr_quoted(writer& out, const T& x)
+{
+    scratch<std::string> text;
+    string_output text_out(&*text);
+
+    {
+        writer w(text_out, out, out.probing());
+        repr_stream(w, x, overload_priority<0>());
+        w.finish();
+    }
+
+    text_out.finish();
+    out.put('"');
+    write_string_data(out, text->data(), text->size());
+    out.put('"');
+}
+
+#ifdef ENABLE_REPR_STATS
+/// Totals of one category over all threads; see `repr_stats_snapshot()`.
+struct category_totals {
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> nodes;
+    std::atomic<std::uint64_t> bytes;
+    std::atomic<std::uint64_t> scratch_growths;
+    std::atomic<std::uint64_t> nanoseconds;
+    std::atomic<std::size_t> max_depth;
+};
+
+inline category_totals* stats_totals()
+{
+    static category_totals totals[category_count];
+    return totals;
+}
+
+/**
+ * Measures the rendering of one value, from construction to destruction, and
+ * adds it to the totals of its category.
+ *
+ * Bytes, scratch growths and time of nested values are subtracted, so that
+ * each category is only charged for its own work.
+ */
+class stats_scope
+{
+  public:
+    explicit stats_scope(category c)
+        : category_(c), local_(thread_stats::local()), parent_(local_.scope),
+          bytes_(local_.bytes), scratch_growths_(local_.scratch_growths),
+          start_(clock::now())
+    {
+        ++local_.depth;
+        local_.scope = this;
+    }
+
+    ~stats_scope()
+    {
+        std::uint64_t nanoseconds = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                                 start_)
+                .count());
+        std::uint64_t bytes = local_.bytes - bytes_;
+        std::uint64_t growths = local_.scratch_growths - scratch_growths_;
+
+        category_totals& totals =
+            stats_totals()[static_cast<std::size_t>(category_)];
+        std::memory_order relaxed = std::memory_order_relaxed;
+
+        if (!parent_)
+            totals.calls.fetch_add(1, relaxed);
+        totals.nodes.fetch_add(1, relaxed);
+        totals.bytes.fetch_add(bytes - nested_bytes_, relaxed);
+        totals.scratch_growths.fetch_add(growths - nested_scratch_growths_,
+                                         relaxed);
+        totals.nanoseconds.fetch_add(nanoseconds - nested_nanoseconds_,
+                                     relaxed);
+
+        std::size_t depth = totals.max_depth.load(relaxed);
+        while (depth < local_.depth &&
+               !totals.max_depth.compare_exchange_weak(depth, local_.depth,
+                                                       relaxed))
+            ;
+
+        if (parent_) {
+            parent_->nested_bytes_ += bytes;
+            parent_->nested_scratch_growths_ += growths;
+            parent_->nested_nanoseconds_ += nanoseconds;
+        }
+
+        --local_.depth;
+        local_.scope = parent_;
+    }
+
+    stats_scope(const stats_scope&) = delete;
+    stats_scope& operator=(const stats_scope&) = delete;
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    category category_;
+    thread_stats& local_;
+    stats_scope* parent_;
+    std::uint64_t bytes_;
+    std::uint64_t scratch_growths_;
+    clock::time_point start_;
+    std::uint64_t nested_bytes_ = 0;
+    std::uint64_t nested_scratch_growths_ = 0;
+    std::uint64_t nested_nanoseconds_ = 0;
+};
+#endif
+
+// dispatch to one of the overloads above
+template <typename T> void repr_stream(writer& out, const T& x)
+{
+#ifdef ENABLE_REPR_STATS
+    stats_scope scope(category_of<T>::value);
+#endif
+
+    if (out.options().json && !has_json_form(category_of<T>::value))
+        repr_quoted(out, x);
+    else
+        repr_stream(out, x, overload_priority<0>());
+}
+
+enum class tristate { no, yes, maybe };
+
+constexpr bracketing bracketing_for(tristate delimiters, tristate enclosed)
+{
+    return delimiters == tristate::no || enclosed == tristate::yes
+               ? bracketing::never
+               : delimiters == tristate::yes && enclosed == tristate::no
+                     ? bracketing::always
+                     : bracketing::depends;
+}
+
+template <tristate d, tristate e> struct basic_text_shape {
+    static const tristate delimiters = d;
+    static const tristate enclosed = e;
+    static const bracketing brackets = bracketing_for(d, e);
+};
+
+/**
+ * What is known at compile time about the text of a value of type `T` which
+ * falls into `Category`: whether it contains whitespace or commas, whether it
+ * is enclosed in `{...}` or `[...]`, and so whether it needs bracketing as an
+ * element of a container.
+ */
+template <typename T, typename Category = category_of<T>>
+struct text_shape : basic_text_shape<tristate::maybe, tristate::maybe> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::function>>
+    : basic_text_shape<tristate::no, tristate::no> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::number>>
+    : basic_text_shape<tristate::no, tristate::no> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::other>>
+    : basic_text_shape<tristate::no, tristate::no> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::map>>
+    : basic_text_shape<tristate::maybe, tristate::yes> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::iterable>>
+    : basic_text_shape<tristate::maybe, tristate::yes> {
+};
+
+// shape of what a pointer-like points to, unless it points to itself
+template <typename T,
+          typename Pointee = typename std::decay<decltype(*val<T>())>::type>
+struct pointee_text_shape : text_shape<Pointee> {
+};
+
+template <typename T>
+struct pointee_text_shape<T, T>
+    : basic_text_shape<tristate::maybe, tristate::maybe> {
+};
+
+template <>
+struct text_shape<std::nullptr_t, category_tag<category::pointer>>
+    : basic_text_shape<tristate::no, tristate::no> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::iterator>>
+    : pointee_text_shape<T> {
+};
+
+// like the pointee, but might also be "nullptr"
+template <typename T> struct text_shape<T, category_tag<category::pointer>> {
+    typedef pointee_text_shape<T> pointee;
+
+    static const tristate delimiters =
+        pointee::delimiters == tristate::no ? tristate::no : tristate::maybe;
+    static const tristate enclosed =
+        pointee::enclosed == tristate::no ? tristate::no : tristate::maybe;
+    static const bracketing brackets = pointee::brackets == bracketing::never
+                                           ? bracketing::never
+                                           : bracketing::depends;
+};
+
+// "()" and "(x)" have the delimiters of x, anything longer has ", "
+template <typename T, std::size_t n = std::tuple_size<T>::value>
+struct tuple_text_shape : basic_text_shape<tristate::yes, tristate::no> {
+};
+
+template <typename T>
+struct tuple_text_shape<T, 0> : basic_text_shape<tristate::no, tristate::no> {
+};
+
+template <typename T>
+struct tuple_text_shape<T, 1>
+    : basic_text_shape<
+          text_shape<typename std::decay<
+              typename std::tuple_element<0, T>::type>::type>::delimiters,
+          tristate::no> {
+};
+
+template <typename T>
+struct text_shape<T, category_tag<category::tuple>> : tuple_text_shape<T> {
+};
+
+template <typename T>
+struct text_shape<cached_value<T>, category_tag<category::cached>>
+    : text_shape<T> {
+};
+
+template <typename T> struct bracketing_of {
+    static const bracketing value = text_shape<T>::brackets;
+};
+} // namespace repr_impl
+
+namespace repr_impl
+{
+// Do the work that some accessors of `x` do lazily on first use, so that it
+// can be rendered from several threads at once.
+template <typename T> void prepare_shared(const T&) {}
+
+template <typename T> void prepare_shared(T* x)
+{
+    if (x != nullptr)
+        prepare_shared(*x);
+}
+
+#ifdef ENABLE_REPR_LLVM
+inline void prepare_shared(const llvm::Function& func)
+{
+    func.arg_begin(); // creates the arguments of lazily loaded functions
+}
+
+inline void prepare_shared(const llvm::Module& module)
+{
+    for (auto& func : module)
+        prepare_shared(func);
+}
+#endif
+
+/// The elements of a container within the element budget; see
+/// `for_each_shown()`.
+template <typename Element> class element_collector
+{
+  public:
+    void operator()(const Element& x)
+    {
+        prepare_shared(x);
+        elements_.push_back(&x);
+    }
+
+    void elided(std::size_t count)
+    {
+        elided_at_ = elements_.size();
+        elided_count_ = count;
+    }
+
+    const std::vector<const Element*>& elements() const { return elements_; }
+
+    /// Index of the element before which the rest was elided, if any.
+    std::size_t elided_at() const { return elided_at_; }
+
+    std::size_t elided_count() const { return elided_count_; }
+
+  private:
+    std::vector<const Element*> elements_;
+    std::size_t elided_at_ = std::numeric_limits<std::size_t>::max();
+    std::size_t elided_count_ = 0;
+};
+
+/**
+ * Run `task(i, options)` for each `i` below `count` on `threads` threads
+ * (including the calling one). Each thread claims the next task as soon as
+ * it's done with the previous one. The first exception thrown by a task is
+ * rethrown once all threads have stopped.
+ *
+ * Tasks get `options` with a `repr_llvm_session` of their own thread, as the
+ * sessions can't be shared between threads.
+ */
+template <typename F>
+void run_parallel(std::size_t count, unsigned threads,
+                  const repr_options& options, F task)
+{
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&]() {
+        repr_options local = options;
+#ifdef ENABLE_REPR_LLVM
+        repr_llvm_session session;
+        local.llvm_session = &session;
+#endif
+
+        try {
+            std::size_t i;
+            while ((i = next++) < count)
+                task(i, static_cast<const repr_options&>(local));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            next = count;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < count; ++t)
+        pool.emplace_back(work);
+
+    work();
+
+    for (auto& thread : pool)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// render each of `elements` into the corresponding string of `texts`, the
+// same way as they are rendered as elements of a container
+template <typename Element>
+void render_elements(const std::vector<const Element*>& elements,
+                     std::vector<std::string>& texts,
+                     const repr_options& options, unsigned threads)
+{
+    run_parallel(elements.size(), threads, options,
+                 [&](std::size_t i, const repr_options& local) {
+                     string_output out(&texts[i]);
+                     writer w(out, local);
+                     w.enter(); // one level down, like inside the container
+                     repr_stream(w, *elements[i]);
+                     w.finish();
+                     out.finish();
+                 });
+}
+
+/// Random-access containers with fewer elements are not split into chunks.
+const std::size_t parallel_chunk_min = 1024;
+
+/**
+ * Renders a large random-access container in chunks of consecutive elements,
+ * each into its own string. The elements shown are the first `head` ones and
+ * the last `tail` ones, with `elided` elements in between.
+ *
+ * Whether the elements need bracketing is decided first, by a parallel
+ * probing pass that stops at the first element that does.
+ */
+template <typename T> class chunked_renderer
+{
+  public:
+    chunked_renderer(const T& xs, const repr_options& options,
+                     unsigned threads)
+        : xs_(xs), options_(options), threads_(threads)
+    {
+        std::size_t size = static_cast<std::size_t>(xs.end() - xs.begin());
+        std::size_t limit = options.max_elements;
+
+        head_ = size;
+        if (limit != 0 && size > limit) {
+            head_ = limit;
+            tail_ = std::min(options.tail_elements, size - limit);
+            elided_ = size - limit - tail_;
+        }
+
+        tail_start_ = size - tail_;
+
+        std::size_t shown = head_ + tail_;
+        chunk_size_ = std::max(parallel_chunk_min, shown / (threads * 8) + 1);
+    }
+
+    /// Whether there are enough elements for splitting them to pay off.
+    bool worth_it() const
+    {
+        return threads_ > 1 && head_ + tail_ >= 2 * parallel_chunk_min;
+    }
+
+    void render(std::string& result)
+    {
+        bracketing known =
+            options_.json ? bracketing::never : element_bracketing<T>::value;
+        brackets_ = known == bracketing::always ||
+                    (known == bracketing::depends && probe());
+
+        std::size_t head_chunks = chunks(head_);
+        std::vector<std::string> texts(head_chunks + chunks(tail_));
+
+        run_parallel(texts.size(), threads_, options_,
+                     [&](std::size_t c, const repr_options& local) {
+                         // all but the very first chunk follow an element
+                         // or the marker of the elided ones
+                         render_chunk(texts[c], local,
+                                      chunk_first(c, head_chunks),
+                                      chunk_last(c, head_chunks),
+                                      c != 0 || c >= head_chunks);
+                     });
+
+        std::size_t total = 2;
+        for (auto& text : texts)
+            total += text.size();
+        result.reserve(result.size() + total);
+
+        result += '[';
+        for (std::size_t c = 0; c < texts.size(); ++c) {
+            if (c == head_chunks && elided_ != 0)
+                write_marker(result);
+
+            result += texts[c];
+        }
+
+        if (texts.size() == head_chunks && elided_ != 0)
+            write_marker(result);
+
+        result += ']';
+    }
+
+  private:
+    std::size_t chunks(std::size_t count) const
+    {
+        return (count + chunk_size_ - 1) / chunk_size_;
+    }
+
+    // index of the first element of chunk `c`, the head ones coming first
+    std::size_t chunk_first(std::size_t c, std::size_t head_chunks) const
+    {
+        return c < head_chunks ? c * chunk_size_
+                               : tail_start_ + (c - head_chunks) * chunk_size_;
+    }
+
+    // index past the last element of chunk `c`
+    std::size_t chunk_last(std::size_t c, std::size_t head_chunks) const
+    {
+        return std::min(c < head_chunks ? head_ : tail_start_ + tail_,
+                        chunk_first(c, head_chunks) + chunk_size_);
+    }
+
+    const typename std::decay<decltype(*val<const T&>().begin())>::type&
+    element(std::size_t i) const
+    {
+        return *(xs_.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+
+    // whether any of the elements shown needs bracketing
+    bool probe()
+    {
+        std::atomic<bool> found(false);
+        std::size_t head_chunks = chunks(head_);
+
+        run_parallel(head_chunks + chunks(tail_), threads_, options_,
+                     [&](std::size_t c, const repr_options& local) {
+                         std::size_t first = chunk_first(c, head_chunks);
+                         std::size_t last = chunk_last(c, head_chunks);
+
+                         std::string unused;
+                         string_output unused_out(&unused);
+                         writer parent(unused_out, local);
+                         parent.enter();
+
+                         scan_output scan;
+                         writer probe(scan, parent, true);
+
+                         for (std::size_t i = first; i != last && !found; ++i) {
+                             scan.reset();
+                             repr_nested(probe, element(i));
+                             if (scan.needs_brackets())
+                                 found = true;
+                         }
+                     });
+
+        return found;
+    }
+
+    void render_chunk(std::string& text, const repr_options& local,
+                      std::size_t first, std::size_t last, bool leading_comma)
+    {
+        string_output out(&text);
+        writer w(out, local);
+        w.enter(); // one level down, like inside the container
+
+        element_writer elements(w, brackets_);
+        if (leading_comma)
+            elements.separator();
+
+        for (std::size_t i = first; i != last; ++i)
+            elements(element(i));
+
+        // keep whitespace at the end: the next chunk continues the element
+        w.write_verbatim("", 0);
+        w.finish();
+        out.finish();
+    }
+
+    // the "<N more>" in between the head and the tail
+    void write_marker(std::string& result) const
+    {
+        result += ", ";
+
+        string_output out(&result);
+        writer w(out, options_);
+        write_elided_element(w, elided_);
+        w.finish();
+        out.finish();
+    }
+
+    const T& xs_;
+    const repr_options& options_;
+    unsigned threads_;
+    std::size_t head_ = 0;
+    std::size_t tail_ = 0;
+    std::size_t tail_start_ = 0;
+    std::size_t elided_ = 0;
+    std::size_t chunk_size_ = 0;
+    bool brackets_ = false;
+};
+
+// whether `repr_parallel()` can render `T` element by element
+template <typename T, typename = void>
+struct is_parallel_renderable : std::false_type {
+};
+
+template <typename T>
+struct is_parallel_renderable<
+    T, typename enable_if<
+           is_same<category_of<T>, category_tag<category::iterable>>::value &&
+           is_multipass<decltype(val<const T&>().begin())>::value &&
+           std::is_lvalue_reference<decltype(
+               *val<const T&>().begin())>::value>::type> : std::true_type {
+};
+
+// large random-access containers: render chunks of elements, if worth it
+template <typename T>
+bool repr_parallel_chunked(std::string& result, const T& xs,
+                           const repr_options& options, unsigned threads,
+                           std::true_type)
+{
+    chunked_renderer<T> renderer(xs, options, threads);
+
+    if (!renderer.worth_it())
+        return false;
+
+    renderer.render(result);
+    return true;
+}
+
+template <typename T>
+bool repr_parallel_chunked(std::string&, const T&, const repr_options&,
+                           unsigned, std::false_type)
+{
+    return false;
+}
+
+template <typename T>
+void repr_parallel(std::string& result, const T& xs,
+                   const repr_options& options, unsigned threads,
+                   std::true_type)
+{
+    typedef typename std::decay<decltype(*xs.begin())>::type element_type;
+
+    // anything that depends on the elements rendered before: go serially
+    if (options.max_bytes != 0 || options.track_pointers ||
+        options.line_width != 0 || options.render_cache != nullptr ||
+        threads == 1) {
+        repr_into(result, xs, options);
+        return;
+    }
+
+    if (repr_parallel_chunked(result, xs, options, threads,
+                              is_random_access<decltype(xs.begin())>()))
+        return;
+
+    std::string unused;
+    string_output unused_out(&unused);
+    writer budget(unused_out, options);
+
+    element_collector<element_type> shown;
+    for_each_shown(budget, xs, shown);
+
+    const auto& elements = shown.elements();
+    std::vector<std::string> texts(elements.size());
+    render_elements(elements, texts, options,
+                    static_cast<unsigned>(std::min<std::size_t>(
+                        threads, std::max<std::size_t>(elements.size(), 1))));
+
+    bracketing known =
+        options.json ? bracketing::never : element_bracketing<T>::value;
+    bool brackets = known == bracketing::always;
+
+    if (known == bracketing::depends) {
+        for (auto& text : texts)
+            brackets = brackets || needs_brackets(text.data(), text.size());
+    }
+
+    string_output str_out(&result);
+    writer w(str_out, options);
+    list_writer list(w);
+
+    w.put('[');
+    for (std::size_t i = 0; i <= texts.size(); ++i) {
+        if (i == shown.elided_at())
+            list.elided(shown.elided_count());
+
+        if (i == texts.size())
+            break;
+
+        list.separator();
+
+        if (brackets)
+            w.put('<');
+
+        w.write(texts[i]);
+
+        if (brackets)
+            w.put('>');
+    }
+    w.put(']');
+    w.finish();
+    str_out.finish();
+}
+
+template <typename T>
+void repr_parallel(std::string& result, const T& x,
+                   const repr_options& options, unsigned, std::false_type)
+{
+    repr_into(result, x, options);
+}
+} // namespace repr_impl
+
+/**
+ * Same as `repr(xs)`, but the elements of the container `xs` are rendered on
+ * `threads` threads (all hardware threads by default) and then put together
+ * in their original order. The result is identical to that of `repr()`.
+ *
+ * This pays off for containers of elements which take long to render, e.g.
+ * the functions of an `llvm::Module` or lists of LLVM instructions, and for
+ * very large random-access containers, which are split into chunks of
+ * consecutive elements rendered into one buffer each. Whatever
+ * the elements refer to must not be modified meanwhile. Anything else,
+ * including containers of single-pass iterators and renders with
+ * `repr_options::max_bytes`, `track_pointers`, `line_width` or
+ * `render_cache`, is rendered serially.
+ */
+template <typename T>
+std::string repr_parallel(const T& xs,
+                          const repr_options& options = repr_options(),
+                          unsigned threads = 0)
+{
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::string result;
+    repr_impl::repr_parallel(result, xs, options, threads,
+                             repr_impl::is_parallel_renderable<T>());
+    return result;
+}
+
+namespace repr_impl
+{
+/// Kinds of nodes in records made by `repr_capture()`.
+enum class captured_kind : unsigned char {
+    boolean,
+    signed_int,
+    unsigned_int,
+    float32,
+    float64,
+    long_float,
+    string,
+    unsized_chars,
+    null,
+    pointer,
+    tuple,
+    list,
+    map,
+    text,
+    bytes,
+    unsized_bytes,
+    string_map
+};
+
+// flags of captured lists, next to their `bracketing` in the low bits
+const unsigned char captured_unsized = 4;
+const unsigned char captured_random_access = 8;
+
+/**
+ * Binary record being captured into a fixed-size buffer.
+ *
+ * Nodes start with their `captured_kind`. Sizes and numbers are stored in the
+ * native byte order. Lists, maps and tuples store their number of elements
+ * and the size of their elements in bytes before the elements, so that they
+ * can be skipped. Once something doesn't fit, the capture fails.
+ */
+class capture_buffer
+{
+  public:
+    capture_buffer(char* buf, std::size_t size)
+        : begin_(buf), pos_(buf), end_(buf + size)
+    {
+    }
+
+    template <typename V> void put(const V& value)
+    {
+        put_bytes(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put_bytes(const char* data, std::size_t size)
+    {
+        if (failed_ || available() < size) {
+            failed_ = true;
+            return;
+        }
+
+        std::memcpy(pos_, data, size);
+        pos_ += size;
+    }
+
+    /// Leave room for `size` bytes, filled in later with `patch()`.
+    std::size_t reserve(std::size_t size)
+    {
+        std::size_t at = offset();
+
+        if (failed_ || available() < size)
+            failed_ = true;
+        else
+            pos_ += size;
+
+        return at;
+    }
+
+    template <typename V> void patch(std::size_t at, const V& value)
+    {
+        if (!failed_)
+            std::memcpy(begin_ + at, &value, sizeof(value));
+    }
+
+    /// Render text in place, as a `captured_kind::text` node.
+    template <typename T> void put_text(const T& x)
+    {
+        put(captured_kind::text);
+        std::size_t header = reserve(sizeof(std::uint64_t));
+
+        if (failed_)
+            return;
+
+        array_output out(pos_, available());
+        repr_options options;
+        writer w(out, options);
+        repr_stream(w, x);
+        w.finish();
+
+        if (out.truncated()) {
+            failed_ = true;
+            return;
+        }
+
+        pos_ += out.size();
+        patch(header, static_cast<std::uint64_t>(out.size()));
+    }
+
+    std::size_t offset() const
+    {
+        return static_cast<std::size_t>(pos_ - begin_);
+    }
+
+    bool failed() const { return failed_; }
+
+  private:
+    std::size_t available() const
+    {
+        return static_cast<std::size_t>(end_ - pos_);
+    }
+
+    char* begin_;
+    char* pos_;
+    char* end_;
+    bool failed_ = false;
+};
+
+/// The count and size of the elements of a node, written once known.
+class capture_compound
+{
+  public:
+    explicit capture_compound(capture_buffer& buf)
+        : buf_(buf), header_(buf.reserve(2 * sizeof(std::uint64_t)))
+    {
+    }
+
+    void finish(std::uint64_t count)
+    {
+        std::size_t start = header_ + 2 * sizeof(std::uint64_t);
+        buf_.patch(header_, count);
+        buf_.patch(header_ + sizeof(std::uint64_t),
+                   static_cast<std::uint64_t>(buf_.offset() - start));
+    }
+
+  private:
+    capture_buffer& buf_;
+    std::size_t header_;
+};
+
+template <typename T> void capture(capture_buffer& buf, const T& x);
+
+// numbers keep their type, which decides how they are formatted
+template <typename T>
+void capture_number(capture_buffer& buf, T value, std::true_type)
+{
+    buf.put(captured_kind::signed_int);
+    buf.put(static_cast<std::int64_t>(value));
+}
+
+template <typename T>
+void capture_number(capture_buffer& buf, T value, std::false_type)
+{
+    buf.put(captured_kind::unsigned_int);
+    buf.put(static_cast<std::uint64_t>(value));
+}
+
+template <typename T> void capture_number(capture_buffer& buf, T value)
+{
+    capture_number(buf, value, std::is_signed<T>());
+}
+
+inline void capture_number(capture_buffer& buf, bool value)
+{
+    buf.put(captured_kind::boolean);
+    buf.put(static_cast<unsigned char>(value));
+}
+
+inline void capture_number(capture_buffer& buf, float value)
+{
+    buf.put(captured_kind::float32);
+    buf.put(value);
+}
+
+inline void capture_number(capture_buffer& buf, double value)
+{
+    buf.put(captured_kind::float64);
+    buf.put(value);
+}
+
+inline void capture_number(capture_buffer& buf, long double value)
+{
+    buf.put(captured_kind::long_float);
+    buf.put(value);
+}
+
+template <typename T, std::size_t n> struct tuple_capture {
+    void operator()(capture_buffer& buf, const T& tuple)
+    {
+        tuple_capture<T, n - 1>()(buf, tuple);
+        capture(buf, std::get<n - 1>(tuple));
+    }
+};
+
+template <typename T> struct tuple_capture<T, 0> {
+    void operator()(capture_buffer&, const T&) {}
+};
+
+// The overloads below follow the categories of the `repr_stream` overloads.
+// Values without structure to keep are rendered to text right away.
+template <typename T, typename Category>
+void capture(capture_buffer& buf, const T& x, Category)
+{
+    buf.put_text(x);
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& x, category_tag<category::string>)
+{
+    const char* data;
+    std::size_t size;
+    string_data(x, &data, &size);
+
+    buf.put(captured_kind::string);
+    buf.put(static_cast<std::uint64_t>(size));
+    buf.put_bytes(data, size);
+}
+
+inline void capture(capture_buffer& buf, const std::nullptr_t&,
+                    category_tag<category::pointer>)
+{
+    buf.put(captured_kind::null);
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& x, category_tag<category::pointer>)
+{
+    if (!x) {
+        buf.put(captured_kind::null);
+    } else {
+        buf.put(captured_kind::pointer);
+        capture(buf, *x);
+    }
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& x,
+             category_tag<category::iterator>)
 {
-    std::string result;
-    llvm::raw_string_ostream raw(result);
-    raw << x;
-    out << result;
+    buf.put(captured_kind::pointer);
+    capture(buf, *x);
 }
-#endif
 
-// other: just print the address
 template <typename T>
-void repr_stream(std::ostream& out, const T& x, overload_priority<100>)
+void capture(capture_buffer& buf, const T& x, category_tag<category::tuple>)
 {
-    out << "<" << &x << ">";
+    buf.put(captured_kind::tuple);
+    capture_compound elements(buf);
+    tuple_capture<T, std::tuple_size<T>::value>()(buf, x);
+    elements.finish(std::tuple_size<T>::value);
 }
 
-// dispatch to one of the overloads above
-template <typename T> void repr_stream(std::ostream& out, const T& x)
+template <typename T>
+void capture(capture_buffer& buf, const T& x, category_tag<category::number>)
+{
+    capture_number(buf, x);
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& xs, category_tag<category::map>)
+{
+    buf.put(has_string_keys(xs) ? captured_kind::string_map
+                                : captured_kind::map);
+    capture_compound entries(buf);
+    std::uint64_t count = 0;
+
+    for (auto it = xs.begin(); it != xs.end() && !buf.failed(); ++it) {
+        capture(buf, it->first);
+        capture(buf, it->second);
+        ++count;
+    }
+
+    entries.finish(count);
+}
+
+template <typename T>
+void capture_chars(capture_buffer& buf, const T& xs, std::true_type)
+{
+    buf.put(captured_kind::string);
+    buf.put(static_cast<std::uint64_t>(xs.size()));
+    buf.put_bytes(xs.data(), static_cast<std::size_t>(xs.size()));
+}
+
+template <typename T>
+void capture_chars(capture_buffer& buf, const T& xs, std::false_type)
+{
+    bool sized = container_size(xs, overload_priority<0>()) != unknown_count;
+    buf.put(sized ? captured_kind::string : captured_kind::unsized_chars);
+
+    std::size_t header = buf.reserve(sizeof(std::uint64_t));
+    std::uint64_t size = 0;
+
+    for (char c : xs) {
+        buf.put(c);
+        ++size;
+    }
+
+    buf.patch(header, size);
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& xs, category_tag<category::chars>)
+{
+    capture_chars(buf, xs, is_contiguous_chars<T>());
+}
+
+template <typename T>
+void capture_bytes(capture_buffer& buf, const T& xs, std::true_type)
+{
+    buf.put(captured_kind::bytes);
+    buf.put(static_cast<std::uint64_t>(xs.size()));
+    buf.put_bytes(reinterpret_cast<const char*>(xs.data()),
+                  static_cast<std::size_t>(xs.size()));
+}
+
+template <typename T>
+void capture_bytes(capture_buffer& buf, const T& xs, std::false_type)
+{
+    bool sized = container_size(xs, overload_priority<0>()) != unknown_count;
+    buf.put(sized ? captured_kind::bytes : captured_kind::unsized_bytes);
+
+    std::size_t header = buf.reserve(sizeof(std::uint64_t));
+    std::uint64_t size = 0;
+
+    for (auto it = xs.begin(); it != xs.end(); ++it) {
+        buf.put(static_cast<unsigned char>(*it));
+        ++size;
+    }
+
+    buf.patch(header, size);
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& xs, category_tag<category::bytes>)
+{
+    capture_bytes(buf, xs, is_contiguous_bytes<T>());
+}
+
+template <typename T>
+void capture(capture_buffer& buf, const T& xs,
+             category_tag<category::iterable>)
+{
+    bool sized = container_size(xs, overload_priority<0>()) != unknown_count;
+    unsigned char flags =
+        static_cast<unsigned char>(element_bracketing<T>::value) |
+        (sized ? 0 : captured_unsized) |
+        (is_random_access<decltype(xs.begin())>::value
+             ? captured_random_access
+             : 0);
+
+    buf.put(captured_kind::list);
+    buf.put(flags);
+    capture_compound elements(buf);
+    std::uint64_t count = 0;
+
+    for (auto it = xs.begin(); it != xs.end() && !buf.failed(); ++it) {
+        capture(buf, *it);
+        ++count;
+    }
+
+    elements.finish(count);
+}
+
+template <typename T> void capture(capture_buffer& buf, const T& x)
+{
+    if (!buf.failed())
+        capture(buf, x, category_of<T>());
+}
+
+template <typename V> V read_captured(const char* data)
+{
+    V value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// End of the node at `node` if it's well-formed and within `end`, otherwise
+// nullptr. Records are checked with this before they are decoded.
+inline const char* captured_end(const char* node, const char* end)
+{
+    if (node == nullptr || node >= end)
+        return nullptr;
+
+    const char* p = node + 1;
+    std::size_t left = static_cast<std::size_t>(end - p);
+    auto kind = static_cast<captured_kind>(*node);
+
+    switch (kind) {
+    case captured_kind::boolean:
+        return left >= 1 ? p + 1 : nullptr;
+    case captured_kind::float32:
+        return left >= sizeof(float) ? p + sizeof(float) : nullptr;
+    case captured_kind::signed_int:
+    case captured_kind::unsigned_int:
+    case captured_kind::float64:
+        return left >= 8 ? p + 8 : nullptr;
+    case captured_kind::long_float:
+        return left >= sizeof(long double) ? p + sizeof(long double)
+                                           : nullptr;
+    case captured_kind::string:
+    case captured_kind::unsized_chars:
+    case captured_kind::text:
+    case captured_kind::bytes:
+    case captured_kind::unsized_bytes: {
+        if (left < 8)
+            return nullptr;
+
+        std::uint64_t size = read_captured<std::uint64_t>(p);
+        return left - 8 >= size ? p + 8 + size : nullptr;
+    }
+    case captured_kind::null:
+        return p;
+    case captured_kind::pointer:
+        return captured_end(p, end);
+    case captured_kind::list:
+        if (left < 1 || (*p & 3) > 2)
+            return nullptr;
+        ++p;
+        --left;
+        // fall through
+    case captured_kind::tuple:
+    case captured_kind::map:
+    case captured_kind::string_map: {
+        if (left < 16)
+            return nullptr;
+
+        std::uint64_t count = read_captured<std::uint64_t>(p);
+        std::uint64_t size = read_captured<std::uint64_t>(p + 8);
+        p += 16;
+
+        if (left - 16 < size)
+            return nullptr;
+
+        const char* elements_end = p + size;
+        bool entries = kind == captured_kind::map ||
+                       kind == captured_kind::string_map;
+        std::uint64_t nodes = entries ? 2 * count : count;
+
+        for (std::uint64_t i = 0; i < nodes && p != nullptr; ++i)
+            p = captured_end(p, elements_end);
+
+        return p == elements_end ? p : nullptr;
+    }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Node of a record made by `repr_capture()`, which renders the same way as the
+ * value it was captured from. Only made for records checked with
+ * `captured_end()`.
+ */
+class captured
+{
+  public:
+    explicit captured(const char* node) : node_(node) {}
+
+    captured_kind kind() const { return static_cast<captured_kind>(*node_); }
+
+    /// What follows the kind.
+    const char* payload() const { return node_ + 1; }
+
+    const char* end() const
+    {
+        const char* p = payload();
+
+        switch (kind()) {
+        case captured_kind::boolean:
+            return p + 1;
+        case captured_kind::float32:
+            return p + sizeof(float);
+        case captured_kind::long_float:
+            return p + sizeof(long double);
+        case captured_kind::string:
+        case captured_kind::unsized_chars:
+        case captured_kind::text:
+        case captured_kind::bytes:
+        case captured_kind::unsized_bytes:
+            return p + 8 + read_captured<std::uint64_t>(p);
+        case captured_kind::null:
+            return p;
+        case captured_kind::pointer:
+            return captured(p).end();
+        case captured_kind::list:
+            return p + 17 + read_captured<std::uint64_t>(p + 9);
+        case captured_kind::tuple:
+        case captured_kind::map:
+        case captured_kind::string_map:
+            return p + 16 + read_captured<std::uint64_t>(p + 8);
+        default:
+            return p + 8;
+        }
+    }
+
+  private:
+    const char* node_;
+};
+
+/// Iterator over consecutive captured nodes.
+class captured_iterator
+{
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef captured value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const captured* pointer;
+    typedef captured reference;
+
+    explicit captured_iterator(const char* pos) : current_(pos), pos_(pos) {}
+
+    captured operator*() const { return current_; }
+    const captured* operator->() const { return &current_; }
+
+    captured_iterator& operator++()
+    {
+        pos_ = current_.end();
+        current_ = captured(pos_);
+        return *this;
+    }
+
+    bool operator==(const captured_iterator& other) const
+    {
+        return pos_ == other.pos_;
+    }
+
+    bool operator!=(const captured_iterator& other) const
+    {
+        return pos_ != other.pos_;
+    }
+
+  private:
+    captured current_;
+    const char* pos_;
+};
+
+/// The elements of a captured container, rendered by the iterable overload.
+class captured_list
+{
+  public:
+    explicit captured_list(const captured& node) : p_(node.payload()) {}
+
+    captured_iterator begin() const { return captured_iterator(p_ + 17); }
+
+    captured_iterator end() const
+    {
+        return captured_iterator(p_ + 17 +
+                                 read_captured<std::uint64_t>(p_ + 9));
+    }
+
+    std::size_t count() const
+    {
+        return static_cast<std::size_t>(read_captured<std::uint64_t>(p_ + 1));
+    }
+
+    repr_impl::bracketing bracketing() const
+    {
+        return static_cast<repr_impl::bracketing>(*p_ & 3);
+    }
+
+    bool sized() const { return !(*p_ & captured_unsized); }
+
+    bool random_access() const { return *p_ & captured_random_access; }
+
+  private:
+    const char* p_;
+};
+
+/// Key and value of a captured map.
+struct captured_entry {
+    captured first;
+    captured second;
+};
+
+/// Iterator over the entries of a captured map.
+class captured_entry_iterator
+{
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef captured_entry value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const captured_entry* pointer;
+    typedef captured_entry reference;
+
+    explicit captured_entry_iterator(const char* pos)
+        : entry_{captured(pos), captured(pos)}, pos_(pos)
+    {
+    }
+
+    captured_entry operator*() const
+    {
+        captured key(pos_);
+        return captured_entry{key, captured(key.end())};
+    }
+
+    const captured_entry* operator->() const
+    {
+        entry_ = **this;
+        return &entry_;
+    }
+
+    captured_entry_iterator& operator++()
+    {
+        pos_ = (**this).second.end();
+        return *this;
+    }
+
+    bool operator==(const captured_entry_iterator& other) const
+    {
+        return pos_ == other.pos_;
+    }
+
+    bool operator!=(const captured_entry_iterator& other) const
+    {
+        return pos_ != other.pos_;
+    }
+
+  private:
+    mutable captured_entry entry_;
+    const char* pos_;
+};
+
+/// The entries of a captured map, rendered by the map overload.
+class captured_map
+{
+  public:
+    explicit captured_map(const captured& node)
+        : p_(node.payload()),
+          string_keys_(node.kind() == captured_kind::string_map)
+    {
+    }
+
+    captured_entry_iterator begin() const
+    {
+        return captured_entry_iterator(p_ + 16);
+    }
+
+    captured_entry_iterator end() const
+    {
+        return captured_entry_iterator(p_ + 16 +
+                                       read_captured<std::uint64_t>(p_ + 8));
+    }
+
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(read_captured<std::uint64_t>(p_));
+    }
+
+    bool string_keys() const { return string_keys_; }
+
+  private:
+    const char* p_;
+    bool string_keys_;
+};
+
+inline bool has_string_keys(const captured_map& xs)
+{
+    return xs.string_keys();
+}
+
+// what was known about the elements when they were captured
+inline bracketing elements_bracketing(const captured_list& xs)
+{
+    return xs.bracketing();
+}
+
+inline std::size_t container_size(const captured_list& xs,
+                                  overload_priority<0>)
+{
+    return xs.sized() ? xs.count() : unknown_count;
+}
+
+// the tail of a captured container, if it was random-access
+template <typename It, typename F>
+void for_each_shown_tail(const writer& out, const captured_list& xs, It it,
+                         std::size_t limit, F& f, std::false_type)
+{
+    if (!xs.random_access()) {
+        f.elided(xs.sized() ? xs.count() - limit : unknown_count);
+        return;
+    }
+
+    std::size_t rest = xs.count() - limit;
+    std::size_t tail = std::min(out.options().tail_elements, rest);
+
+    if (tail < rest)
+        f.elided(rest - tail);
+
+    for (std::size_t skip = rest - tail; skip != 0; --skip)
+        ++it;
+
+    for (It end = xs.end(); it != end && !out.done(); ++it)
+        f(*it);
+}
+
+// tuple, like the tuple overload but with the size known only now
+inline void repr_captured_tuple(writer& out, const captured& x)
+{
+    depth_guard guard(out);
+    if (guard.exceeded()) {
+        write_elided_element(out, unknown_count);
+        return;
+    }
+
+    std::size_t count =
+        static_cast<std::size_t>(read_captured<std::uint64_t>(x.payload()));
+    std::size_t limit = out.options().max_elements;
+    bool json = out.options().json;
+    captured element(x.payload() + 16);
+
+    open_group(out, json ? '[' : '(');
+    for (std::size_t i = 0; i < count; ++i) {
+        if (out.done() || (limit != 0 && i > limit))
+            break;
+
+        write_separator(out, i == 0);
+
+        if (limit != 0 && i == limit)
+            write_elided_element(out, count - limit);
+        else
+            repr_nested(out, element);
+
+        element = captured(element.end());
+    }
+    close_group(out, json ? ']' : ')', count > 0);
+}
+
+// values captured by repr_capture(), rendered like what they were captured
+// from
+inline category_tag<category::captured>
+repr_stream(writer& out, const captured& x, overload_priority<0>)
 {
-    repr_stream(out, x, overload_priority<0>());
+    const char* p = x.payload();
+
+    switch (x.kind()) {
+    case captured_kind::boolean:
+        write_number(out, *p != 0);
+        break;
+    case captured_kind::signed_int:
+        write_number(out, read_captured<std::int64_t>(p));
+        break;
+    case captured_kind::unsigned_int:
+        write_number(out, read_captured<std::uint64_t>(p));
+        break;
+    case captured_kind::float32:
+        write_number(out, read_captured<float>(p));
+        break;
+    case captured_kind::float64:
+        write_number(out, read_captured<double>(p));
+        break;
+    case captured_kind::long_float:
+        write_number(out, read_captured<long double>(p));
+        break;
+    case captured_kind::string:
+        write_string(out, p + 8,
+                     static_cast<std::size_t>(read_captured<std::uint64_t>(p)));
+        break;
+    case captured_kind::unsized_chars: {
+        // like the chars overload, which can't tell how many are left out
+        std::size_t size =
+            static_cast<std::size_t>(read_captured<std::uint64_t>(p));
+        std::size_t limit = out.options().max_elements;
+        std::size_t shown = limit != 0 ? std::min(size, limit) : size;
+
+        out.put('"');
+        write_string_data(out, p + 8, shown);
+        end_string(out, shown < size ? unknown_count : 0);
+        break;
+    }
+    case captured_kind::null:
+        write_null(out);
+        break;
+    case captured_kind::pointer:
+        repr_nested(out, captured(p));
+        break;
+    case captured_kind::tuple:
+        repr_captured_tuple(out, x);
+        break;
+    case captured_kind::list:
+        repr_stream(out, captured_list(x));
+        break;
+    case captured_kind::map:
+    case captured_kind::string_map:
+        repr_stream(out, captured_map(x));
+        break;
+    case captured_kind::text: {
+        std::size_t size =
+            static_cast<std::size_t>(read_captured<std::uint64_t>(p));
+
+        // quoted in JSON, as by repr_quoted()
+        if (out.options().json) {
+            out.put('"');
+            write_string_data(out, p + 8, size);
+            out.put('"');
+        } else {
+            out.write(p + 8, size);
+        }
+        break;
+    }
+    case captured_kind::bytes:
+    case captured_kind::unsized_bytes:
+        write_byte_buffer(
+            out, reinterpret_cast<const unsigned char*>(p + 8),
+            static_cast<std::size_t>(read_captured<std::uint64_t>(p)),
+            x.kind() == captured_kind::bytes);
+        break;
+    }
+
+    return {};
 }
 } // namespace repr_impl
 
+/**
+ * Capture `x` into `buf` of size `size` as a compact binary record, which
+ * `repr_decode()` turns into the text `repr(x)` gives, later or elsewhere.
+ *
+ * Strings, numbers, pointers, tuples and containers are copied as they are.
+ * Anything else is rendered to text right away. Returns the size of the
+ * record, or 0 if it doesn't fit.
+ */
+template <typename T>
+std::size_t repr_capture(char* buf, std::size_t size, const T& x)
+{
+    repr_impl::capture_buffer out(buf, size);
+    repr_impl::capture(out, x);
+    return out.failed() ? 0 : out.offset();
+}
+
+/**
+ * Append the text of the record `data` of size `size` made by
+ * `repr_capture()` to `out`, rendered with `options` (except for
+ * `track_pointers`, as pointers are captured by value).
+ *
+ * Records are only decoded on the machine that made them. Returns false and
+ * appends nothing if `data` isn't a valid record.
+ */
+inline bool repr_decode(std::string& out, const char* data, std::size_t size,
+                        const repr_options& options = repr_options())
+{
+    if (repr_impl::captured_end(data, data + size) != data + size)
+        return false;
+
+    repr_into(out, repr_impl::captured(data), options);
+    return true;
+}
+
+#ifdef ENABLE_REPR_STATS
+/**
+ * Kinds of values told apart by `repr()`, e.g. `repr_category::iterable` for
+ * containers; see `repr_category_name()`.
+ */
+typedef repr_impl::category repr_category;
+
+/// Counters of one category of values; see `repr_stats_snapshot()`.
+struct repr_category_stats {
+    /// Values rendered at the top level of a `repr()` call.
+    std::uint64_t calls;
+
+    /// Values rendered, including nested ones.
+    std::uint64_t nodes;
+
+    /**
+     * Bytes written by the values themselves, before `max_bytes` is applied.
+     * Whitespace that ends up trimmed is counted too.
+     */
+    std::uint64_t bytes;
+
+    /**
+     * Scratch buffers of the thread that were too small and had to be grown.
+     * Other heap allocations, e.g. by the values themselves, aren't counted.
+     */
+    std::uint64_t scratch_growths;
+
+    /// Time spent rendering, excluding nested values of other categories.
+    std::uint64_t nanoseconds;
+
+    /// Deepest nesting of values a value was rendered at, 1 for the top level.
+    std::size_t max_depth;
+};
+
+/**
+ * Counters of everything rendered since the start of the program or the last
+ * `repr_reset_stats()`, for each category.
+ *
+ * Text rendered only to be inspected (e.g. to decide whether the elements of
+ * a container need brackets) is counted too, as is text written past the end
+ * of a fixed-size buffer.
+ */
+struct repr_stats {
+    repr_category_stats categories[repr_impl::category_count];
+
+    const repr_category_stats& operator[](repr_category c) const
+    {
+        return categories[static_cast<std::size_t>(c)];
+    }
+};
+
+/// Name of `c` as used in this header, e.g. `"llvm_value"`.
+inline const char* repr_category_name(repr_category c)
+{
+    static const char* const names[] = {
+        "custom", "cached",   "function", "string", "pointer",
+        "iterator", "llvm_value", "bytes", "tuple",  "number",
+        "ostream", "map",     "chars",    "iterable", "llvm_raw",
+        "other",  "captured"};
+    static_assert(sizeof(names) / sizeof(names[0]) ==
+                      repr_impl::category_count,
+                  "a category has no name");
+
+    return names[static_cast<std::size_t>(c)];
+}
+
+/**
+ * Counters of all threads collected so far. Only available if
+ * `ENABLE_REPR_STATS` is defined before including this header; otherwise
+ * nothing is measured and rendering doesn't pay for it.
+ */
+inline repr_stats repr_stats_snapshot()
+{
+    repr_stats result;
+    std::memory_order relaxed = std::memory_order_relaxed;
+
+    for (std::size_t i = 0; i < repr_impl::category_count; ++i) {
+        const repr_impl::category_totals& totals = repr_impl::stats_totals()[i];
+        repr_category_stats& stats = result.categories[i];
+
+        stats.calls = totals.calls.load(relaxed);
+        stats.nodes = totals.nodes.load(relaxed);
+        stats.bytes = totals.bytes.load(relaxed);
+        stats.scratch_growths = totals.scratch_growths.load(relaxed);
+        stats.nanoseconds = totals.nanoseconds.load(relaxed);
+        stats.max_depth = totals.max_depth.load(relaxed);
+    }
+
+    return result;
+}
+
+/// Set all counters to 0. Values being rendered meanwhile may be lost.
+inline void repr_reset_stats()
+{
+    std::memory_order relaxed = std::memory_order_relaxed;
+
+    for (std::size_t i = 0; i < repr_impl::category_count; ++i) {
+        repr_impl::category_totals& totals = repr_impl::stats_totals()[i];
+
+        totals.calls.store(0, relaxed);
+        totals.nodes.store(0, relaxed);
+        totals.bytes.store(0, relaxed);
+        totals.scratch_growths.store(0, relaxed);
+        totals.nanoseconds.store(0, relaxed);
+        totals.max_depth.store(0, relaxed);
+    }
+}
+#endif
+
 #endif
@@ -1,9 +1,12 @@
 #define ENABLE_REPR_LLVM
 #include <repr.hpp>
 
+#include <cstdio>
 #include <memory>
 #include <sstream>
 
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/AsmParser/Parser.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/LLVMContext.h>
@@ -123,6 +126,12 @@ TEST(LLVMTests, DebugLocations)
     EXPECT_EQ("bb3(debug.c:6)", repr(bb3));
     EXPECT_EQ("bb5(debug.c:8)", repr(bb5));
     EXPECT_EQ("bb8(debug.c:10)", repr(bb8));
+
+    repr_llvm_session session;
+    repr_options options;
+    options.llvm_session = &session;
+    EXPECT_EQ("bb(debug.c:1)", repr(bb, options));
+    EXPECT_EQ("bb8(debug.c:10)", repr(bb8, options));
 }
 
 TEST(LLVMTests, DebugValues)
@@ -134,17 +143,124 @@ TEST(LLVMTests, DebugValues)
         for (auto& inst : bb) {
             if (inst.getName() == "tmp7") {
                 EXPECT_EQ("tmp7(y@debug.c:8)", repr(inst));
+
+                repr_llvm_session session;
+                repr_options options;
+                options.llvm_session = &session;
+                EXPECT_EQ("tmp7(y@debug.c:8)", repr(inst, options));
             }
         }
     }
 }
 #endif
 
+TEST(LLVMTests, Session)
+{
+    auto module = parseAssembly(bar_src);
+    llvm::Function* bar = &*module->begin();
+    llvm::BasicBlock* bb = &*bar->begin();
+
+    repr_llvm_session session;
+    repr_options options;
+    options.llvm_session = &session;
+
+    std::string expected = repr(bb->getInstList());
+    EXPECT_EQ(expected, repr(bb->getInstList(), options));
+    EXPECT_EQ("bb", repr(bb, options));
+    EXPECT_EQ("%1 = add i32 %0, 1", repr(&*++bb->begin(), options));
+
+    // after modifying the IR the index has to be rebuilt
+    bb->getInstList().front().setName("x");
+    session.invalidate(*bar);
+    EXPECT_EQ("[<x>, <%0 = add i32 %x, 1>, <ret i32 %0>]",
+              repr(bb->getInstList(), options));
+}
+
+TEST(LLVMTests, RenderCache)
+{
+    auto module = parseAssembly(bar_src);
+    llvm::Function* bar = &*module->begin();
+    auto& insts = bar->begin()->getInstList();
+
+    repr_render_cache cache;
+    repr_options options;
+    options.render_cache = &cache;
+
+    std::string expected = repr(insts);
+    EXPECT_EQ(expected, repr(repr_cached(insts), options));
+
+    // the cached text is used until the cache learns about the change
+    insts.front().setName("x");
+    EXPECT_EQ(expected, repr(repr_cached(insts), options));
+    cache.invalidate(insts);
+    EXPECT_EQ("[<x>, <%0 = add i32 %x, 1>, <ret i32 %0>]",
+              repr(repr_cached(insts), options));
+}
+
+TEST(LLVMTests, FileOutput)
+{
+    auto module = parseAssembly(foo_src + bar_src);
+    auto& insts = (++module->begin())->begin()->getInstList();
+
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    EXPECT_TRUE(repr_to_fd(fileno(file), insts));
+    std::rewind(file);
+
+    char buf[256];
+    std::size_t size = std::fread(buf, 1, sizeof(buf), file);
+    EXPECT_EQ(repr(insts), std::string(buf, size));
+    std::fclose(file);
+}
+
+TEST(LLVMTests, RawOstream)
+{
+    llvm::APInt big(128, "123456789012345678901234567890", 10);
+
+    EXPECT_EQ("42", repr(llvm::APInt(32, 42)));
+    EXPECT_EQ("[123456789012345678901234567890, -1]",
+              repr(std::vector<llvm::APInt>{big, llvm::APInt(8, 255)}));
+
+    char buf[8];
+    auto res = repr_into(buf, sizeof(buf), big);
+    EXPECT_EQ("12345678", std::string(buf, res.size));
+    EXPECT_TRUE(res.truncated);
+}
+
+TEST(LLVMTests, Parallel)
+{
+    auto module = parseAssembly(foo_src + bar_src);
+    std::vector<const llvm::BasicBlock::InstListType*> insts;
+
+    for (auto& func : *module) {
+        for (auto& bb : func)
+            insts.push_back(&bb.getInstList());
+    }
+
+    EXPECT_EQ("[foo, bar]", repr_parallel(*module, repr_options(), 2));
+    EXPECT_EQ(repr(insts), repr_parallel(insts, repr_options(), 2));
+}
+
+TEST(LLVMTests, Lazy)
+{
+    auto module = parseAssembly(foo_src + bar_src);
+    std::string result;
+    llvm::raw_string_ostream raw(result);
+    raw << "module " << repr_lazy(*module);
+    EXPECT_EQ("module [foo, bar]", raw.str());
+}
+
 TEST(LLVMTests, StringRef)
 {
     std::string foo = "Hello, world!";
     llvm::StringRef sref(foo);
     EXPECT_EQ("\"Hello, world!\"", repr(sref));
+
+    llvm::SmallString<8> small(sref);
+    EXPECT_EQ("\"Hello, world!\"", repr(small));
+    EXPECT_EQ("[\"Hello\", \"world!\"]",
+              repr(std::vector<llvm::StringRef>{sref.substr(0, 5),
+                                                sref.substr(7)}));
 }
 
 TEST(LLVMTests, Iterators)
@@ -161,3 +277,29 @@ TEST(LLVMTests, Iterators)
     EXPECT_EQ("br label %loop", repr(*module->begin()->begin()->begin()));
     EXPECT_EQ("br label %loop", repr(&*module->begin()->begin()->begin()));
 }
+
+TEST(LLVMTests, Capture)
+{
+    auto module = parseAssembly(foo_src + bar_src);
+    char buf[256];
+    size_t size = repr_capture(buf, sizeof(buf), *module);
+
+    // the functions are rendered when captured, so the module can go away
+    module.reset();
+    std::string result;
+    EXPECT_TRUE(repr_decode(result, buf, size));
+    EXPECT_EQ("[foo, bar]", result);
+}
+
+TEST(LLVMTests, Json)
+{
+    auto module = parseAssembly(bar_src);
+    llvm::Function* bar = &*module->begin();
+    repr_options json;
+    json.json = true;
+
+    EXPECT_EQ("[\"bar\"]", repr(*module, json));
+    EXPECT_EQ("[\"%0 = add i32 %a, 1\", \"%1 = add i32 %0, 1\", "
+              "\"ret i32 %1\"]",
+              repr(bar->begin()->getInstList(), json));
+}
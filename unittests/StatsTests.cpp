@@ -0,0 +1,83 @@
+#define ENABLE_REPR_STATS
+#include <repr.hpp>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+struct Streamable {
+    int x;
+};
+
+std::ostream& operator<<(std::ostream& os, const Streamable& s)
+{
+    return os << "Streamable(" << s.x << ")";
+}
+
+TEST(StatsTests, Categories)
+{
+    repr_reset_stats();
+    std::vector<std::string> strs = {"a", "bc"};
+    EXPECT_EQ("[\"a\", \"bc\"]", repr(strs));
+
+    repr_stats stats = repr_stats_snapshot();
+    EXPECT_EQ(1u, stats[repr_category::iterable].calls);
+    EXPECT_EQ(1u, stats[repr_category::iterable].nodes);
+    EXPECT_EQ(1u, stats[repr_category::iterable].max_depth);
+    EXPECT_EQ(0u, stats[repr_category::string].calls);
+    EXPECT_EQ(2u, stats[repr_category::string].max_depth);
+
+    // the strings are rendered twice, first to see if they need brackets;
+    // every byte is charged to the value that wrote it
+    EXPECT_EQ(4u, stats[repr_category::string].nodes);
+    EXPECT_EQ(4u, stats[repr_category::iterable].bytes);
+    EXPECT_EQ(14u, stats[repr_category::string].bytes);
+    EXPECT_EQ(0u, stats[repr_category::map].nodes);
+
+    repr(std::map<int, Streamable>{{1, {2}}});
+    stats = repr_stats_snapshot();
+    EXPECT_EQ(1u, stats[repr_category::map].calls);
+    EXPECT_EQ(1u, stats[repr_category::ostream].nodes);
+    EXPECT_EQ(13u, stats[repr_category::ostream].bytes);
+    EXPECT_EQ(1u, stats[repr_category::number].nodes);
+
+    std::uint64_t total = 0;
+    for (const repr_category_stats& s : stats.categories)
+        total += s.nodes;
+    EXPECT_EQ(8u, total);
+
+    repr_reset_stats();
+    stats = repr_stats_snapshot();
+    EXPECT_EQ(0u, stats[repr_category::string].nodes);
+    EXPECT_EQ(0u, stats[repr_category::string].max_depth);
+    EXPECT_STREQ("llvm_value", repr_category_name(repr_category::llvm_value));
+    EXPECT_STREQ("captured", repr_category_name(repr_category::captured));
+}
+
+TEST(StatsTests, ScratchGrowths)
+{
+    // in JSON the text of a Streamable is rendered into a scratch buffer
+    // first, which a fresh thread has yet to allocate
+    repr_options json;
+    json.json = true;
+    Streamable s = {123456789};
+    std::uint64_t first = 0;
+    std::uint64_t second = 0;
+
+    std::thread([&] {
+        repr_reset_stats();
+        EXPECT_EQ("\"Streamable(123456789)\"", repr(s, json));
+        first =
+            repr_stats_snapshot()[repr_category::ostream].scratch_growths;
+        repr(s, json);
+        second =
+            repr_stats_snapshot()[repr_category::ostream].scratch_growths;
+    }).join();
+
+    EXPECT_EQ(1u, first);
+    EXPECT_EQ(first, second);
+}
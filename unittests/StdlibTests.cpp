@@ -2,14 +2,39 @@
 
 #include <vector>
 #include <set>
+#include <list>
+#include <forward_list>
 #include <map>
 #include <memory>
 #include <tuple>
+#include <array>
+#include <iterator>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <limits>
+#include <cstdint>
+#include <atomic>
 
 #include <gtest/gtest.h>
 
 using namespace std;
 
+// atomic, as the parallel tests allocate from several threads
+static atomic<size_t> allocation_count(0);
+
+void* operator new(size_t size)
+{
+    ++allocation_count;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
 TEST(StdlibTests, StdString)
 {
     string foo = "foobar";
@@ -112,3 +137,972 @@ TEST(StdlibTests, Array)
     std::array<int, 5> arr = {{1, 2, 3, 4, 5}};
     EXPECT_EQ("(1, 2, 3, 4, 5)", repr(arr));
 }
+
+struct Padded {
+    const char* text;
+};
+
+ostream& operator<<(ostream& out, const Padded& p)
+{
+    return out << "  " << p.text << " \n";
+}
+
+TEST(StdlibTests, NestedTrimming)
+{
+    EXPECT_EQ("x y", repr(Padded{"x y"}));
+    EXPECT_EQ("[<x y>, <z>]", repr(vector<Padded>{{"x y"}, {"z"}}));
+    EXPECT_EQ("[x, z]", repr(vector<Padded>{{"x"}, {"z"}}));
+    EXPECT_EQ("(x y, z)", repr(make_pair(Padded{"x y"}, Padded{"z"})));
+    EXPECT_EQ("{\"k\": y z}", repr(map<string, Padded>{{"k", {"y z"}}}));
+}
+
+TEST(StdlibTests, ReprInto)
+{
+    string buf = "prefix ";
+    repr_into(buf, vector<string>{"a b", "c"});
+    EXPECT_EQ("prefix [<\"a b\">, <\"c\">]", buf);
+
+    repr_into(buf, 1);
+    EXPECT_EQ("prefix [<\"a b\">, <\"c\">]1", buf);
+}
+
+TEST(StdlibTests, ReprIntoBuffer)
+{
+    char buf[16];
+    auto res = repr_into(buf, sizeof(buf), make_tuple(1, "two", -3));
+    EXPECT_EQ("(1, \"two\", -3)", string(buf, res.size));
+    EXPECT_FALSE(res.truncated);
+
+    res = repr_into(buf, 8, vector<int>{100, 200, 300});
+    EXPECT_EQ("[100, 20", string(buf, res.size));
+    EXPECT_TRUE(res.truncated);
+
+    res = repr_into(buf, 0, 1);
+    EXPECT_EQ(0u, res.size);
+    EXPECT_TRUE(res.truncated);
+}
+
+TEST(StdlibTests, ReprIntoIterator)
+{
+    vector<char> chars;
+    repr_into(back_inserter(chars), map<int, bool>{{1, true}, {2, false}});
+    EXPECT_EQ("{1: true, 2: false}", string(chars.begin(), chars.end()));
+
+    ostringstream os;
+    repr_into(ostreambuf_iterator<char>(os), vector<string>(100, "x y"));
+    EXPECT_EQ(repr(vector<string>(100, "x y")), os.str());
+}
+
+TEST(StdlibTests, ReprIntoDoesNotAllocate)
+{
+    vector<pair<string, vector<int>>> data = {{"a b", {1, -2, 3}},
+                                              {"c", {}}};
+    int one = 1;
+    auto tup = make_tuple(&one, "str", 42u, -7LL, true);
+    char buf[256];
+
+    size_t before = allocation_count;
+    auto res1 = repr_into(buf, sizeof(buf), data);
+    auto res2 = repr_into(buf + res1.size, sizeof(buf) - res1.size, tup);
+    EXPECT_EQ(before, allocation_count.load());
+
+    EXPECT_EQ("{\"a b\": [1, -2, 3], \"c\": []}(1, \"str\", 42, -7, true)",
+              string(buf, res1.size + res2.size));
+}
+
+struct IntStream {
+    string text;
+
+    istream_iterator<int> begin() const
+    {
+        in.clear();
+        in.str(text);
+        return istream_iterator<int>(in);
+    }
+
+    istream_iterator<int> end() const { return istream_iterator<int>(); }
+
+    mutable istringstream in;
+};
+
+TEST(StdlibTests, SinglePassRange)
+{
+    IntStream ints;
+    ints.text = "1 2 3";
+    EXPECT_EQ("[1, 2, 3]", repr(ints));
+
+    ints.text = "";
+    EXPECT_EQ("[]", repr(ints));
+}
+
+struct Counted {
+    const char* text;
+};
+
+static atomic<int> counted_renders(0);
+
+ostream& operator<<(ostream& out, const Counted& c)
+{
+    ++counted_renders;
+    return out << c.text;
+}
+
+TEST(StdlibTests, StreamingBracketing)
+{
+    istringstream words("a,b c d");
+    struct {
+        istream* in;
+        istream_iterator<string> begin() const
+        {
+            return istream_iterator<string>(*in);
+        }
+        istream_iterator<string> end() const
+        {
+            return istream_iterator<string>();
+        }
+    } range = {&words};
+    EXPECT_EQ("[<\"a,b\">, <\"c\">, <\"d\">]", repr(range));
+
+    // the probing pass stops at the first element that needs bracketing
+    counted_renders = 0;
+    vector<Counted> cs = {{"x y"}, {"z"}, {"w"}};
+    EXPECT_EQ("[<x y>, <z>, <w>]", repr(cs));
+    EXPECT_EQ(4, counted_renders.load());
+
+    // text enclosed at the start only still needs brackets, and decides it
+    // for the elements after it
+    vector<Counted> tagged = {{"[info] a"}, {"b"}};
+    EXPECT_EQ("[<[info] a>, <b>]", repr(tagged));
+    list<Counted> braced = {{"{a} b"}, {"c"}, {"d"}};
+    EXPECT_EQ("[<{a} b>, <c>, <d>]", repr(braced));
+    EXPECT_EQ(repr(braced), repr_parallel(braced, repr_options(), 2));
+}
+
+TEST(StdlibTests, BracketingTrait)
+{
+    using repr_impl::bracketing;
+    using repr_impl::bracketing_of;
+
+    static_assert(bracketing_of<int>::value == bracketing::never, "");
+    static_assert(bracketing_of<bool>::value == bracketing::never, "");
+    static_assert(bracketing_of<vector<int>>::value == bracketing::never, "");
+    static_assert(bracketing_of<map<string, int>>::value == bracketing::never,
+                  "");
+    static_assert(bracketing_of<int*>::value == bracketing::never, "");
+    static_assert(
+        bracketing_of<unique_ptr<vector<int>>>::value == bracketing::never, "");
+    static_assert(bracketing_of<tuple<>>::value == bracketing::never, "");
+    static_assert(bracketing_of<tuple<int>>::value == bracketing::never, "");
+    static_assert(bracketing_of<pair<int, int>>::value == bracketing::always,
+                  "");
+    static_assert(bracketing_of<tuple<vector<int>>>::value ==
+                      bracketing::depends,
+                  "");
+    static_assert(bracketing_of<string>::value == bracketing::depends, "");
+    static_assert(bracketing_of<Padded>::value == bracketing::depends, "");
+
+    EXPECT_EQ("[<(1, 2)>, <(3, 4)>]",
+              repr(vector<tuple<int, int>>{make_tuple(1, 2),
+                                           make_tuple(3, 4)}));
+    EXPECT_EQ("[(1), (2)]", repr(vector<tuple<int>>{1, 2}));
+    EXPECT_EQ("[<([1, 2])>, <([])>]",
+              repr(vector<tuple<vector<int>>>{make_tuple(vector<int>{1, 2}),
+                                              make_tuple(vector<int>{})}));
+    EXPECT_EQ("[([])]",
+              repr(vector<tuple<vector<int>>>{make_tuple(vector<int>{})}));
+
+    // long enough to go through the vectorized scan
+    string clean(100, 'x');
+    EXPECT_EQ("[\"" + clean + "\"]", repr(vector<string>{clean}));
+    EXPECT_EQ("[<\"" + clean + "\t\">]", repr(vector<string>{clean + "\t"}));
+    EXPECT_EQ("[<\"" + clean + ",\">]", repr(vector<string>{clean + ","}));
+    EXPECT_EQ("[<\"" + clean + "\r" + clean + "\">]",
+              repr(vector<string>{clean + "\r" + clean}));
+}
+
+TEST(StdlibTests, Numbers)
+{
+    EXPECT_EQ("0", repr(0));
+    EXPECT_EQ("-2147483648", repr(numeric_limits<int>::min()));
+    EXPECT_EQ("18446744073709551615", repr(numeric_limits<uint64_t>::max()));
+    EXPECT_EQ("-9223372036854775808", repr(numeric_limits<int64_t>::min()));
+    EXPECT_EQ("[7, 42, 100, 999, 1000]",
+              repr(vector<short>{7, 42, 100, 999, 1000}));
+
+    EXPECT_EQ("0.1", repr(0.1));
+    EXPECT_EQ("0.3333333333333333", repr(1.0 / 3));
+    EXPECT_EQ("-0", repr(-0.0));
+    EXPECT_EQ("100", repr(100.0));
+    EXPECT_EQ("1e+16", repr(1e16));
+    EXPECT_EQ("1234.5", repr(1234.5));
+    EXPECT_EQ("0.0001", repr(0.0001));
+    EXPECT_EQ("1e-05", repr(0.00001));
+    EXPECT_EQ("5e-324", repr(5e-324));
+    EXPECT_EQ("1.7976931348623157e+308", repr(numeric_limits<double>::max()));
+    EXPECT_EQ("0.1", repr(0.1f));
+    EXPECT_EQ("3.4028235e+38", repr(numeric_limits<float>::max()));
+    EXPECT_EQ("0.1", repr(0.1L));
+    EXPECT_EQ("[inf, -inf, nan]",
+              repr(vector<double>{numeric_limits<double>::infinity(),
+                                  -numeric_limits<double>::infinity(),
+                                  numeric_limits<double>::quiet_NaN()}));
+
+    repr_options fixed;
+    fixed.float_precision = 3;
+    EXPECT_EQ("[0.333, 1.23e+04, 2]",
+              repr(vector<double>{1.0 / 3, 12345.0, 2.0}, fixed));
+    EXPECT_EQ("0.333", repr(1.0f / 3, fixed));
+}
+
+TEST(StdlibTests, Budgets)
+{
+    vector<vector<vector<int>>> nested = {{{1, 2}, {3}}, {{4}}};
+    repr_options depth;
+    depth.max_depth = 2;
+    EXPECT_EQ("[[..., ...], [...]]", repr(nested, depth));
+    depth.max_depth = 1;
+    EXPECT_EQ("(1, ...)", repr(make_tuple(1, vector<int>{2}), depth));
+
+    repr_options elements;
+    elements.max_elements = 3;
+    vector<int> ten = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    EXPECT_EQ("[0, 1, 2, <7 more>]", repr(ten, elements));
+    EXPECT_EQ("[0, 1]", repr(vector<int>{0, 1}, elements));
+    EXPECT_EQ("[0, 1, 2, <2 more>]", repr(list<int>{0, 1, 2, 3, 4}, elements));
+    EXPECT_EQ("[0, 1, 2, ...]", repr(forward_list<int>{0, 1, 2, 3}, elements));
+    EXPECT_EQ("{1: 2, 3: 4, 5: 6, <1 more>}",
+              repr(map<int, int>{{1, 2}, {3, 4}, {5, 6}, {7, 8}}, elements));
+    EXPECT_EQ("(1, 2, 3, <2 more>)", repr(make_tuple(1, 2, 3, 4, 5), elements));
+    EXPECT_EQ("\"Hel\"<2 more>", repr(string("Hello"), elements));
+    EXPECT_EQ("[<\"abc\"<1 more>>, <\"x\">]",
+              repr(vector<string>{"abcd", "x"}, elements));
+
+    IntStream ints;
+    ints.text = "1 2 3 4 5";
+    EXPECT_EQ("[1, 2, 3, ...]", repr(ints, elements));
+
+    elements.tail_elements = 2;
+    EXPECT_EQ("[0, 1, 2, <5 more>, 8, 9]", repr(ten, elements));
+    EXPECT_EQ("[0, 1, 2, <2 more>]", repr(list<int>{0, 1, 2, 3, 4}, elements));
+    EXPECT_EQ("[0, 1, 2, 3]", repr(vector<int>{0, 1, 2, 3}, elements));
+    EXPECT_EQ("[0, 1, 2, 3, 4]", repr(vector<int>{0, 1, 2, 3, 4}, elements));
+
+    repr_options bytes;
+    bytes.max_bytes = 10;
+    EXPECT_EQ("[0, 1, ...", repr(ten, bytes));
+    EXPECT_EQ("[0, 1]", repr(vector<int>{0, 1}, bytes));
+    EXPECT_EQ("\"0123456789\"", repr(string("0123456789")));
+    EXPECT_EQ("\"01234a...", repr(string("01234abcdefgh"), bytes));
+    bytes.max_bytes = 2;
+    EXPECT_EQ("..", repr(ten, bytes));
+
+    // budgets bound the work, not just the output
+    counted_renders = 0;
+    vector<Counted> many(1000, Counted{"c"});
+    elements.tail_elements = 0;
+    EXPECT_EQ("[c, c, c, <997 more>]", repr(many, elements));
+    EXPECT_EQ(6, counted_renders.load());
+
+    // so does the bracketing probe, for multi-pass and single-pass ranges
+    counted_renders = 0;
+    bytes.max_bytes = 32;
+    EXPECT_EQ("[c, c, c, c, c, c, c, c, c, c...", repr(many, bytes));
+    EXPECT_GT(60, counted_renders.load());
+    counted_renders = 0;
+    forward_list<Counted> many_list(1000, Counted{"c"});
+    EXPECT_EQ("[c, c, c, c, c, c, c, c, c, c...", repr(many_list, bytes));
+    EXPECT_GT(60, counted_renders.load());
+
+    char buf[16];
+    bytes.max_bytes = 8;
+    auto res = repr_into(buf, sizeof(buf), ten, bytes);
+    EXPECT_EQ("[0, 1...", string(buf, res.size));
+    EXPECT_TRUE(res.truncated);
+}
+
+struct Node {
+    vector<shared_ptr<Node>> children;
+
+    vector<shared_ptr<Node>>::const_iterator begin() const
+    {
+        return children.begin();
+    }
+
+    vector<shared_ptr<Node>>::const_iterator end() const
+    {
+        return children.end();
+    }
+};
+
+TEST(StdlibTests, TrackPointers)
+{
+    repr_options tracked;
+    tracked.track_pointers = true;
+
+    auto shared = make_shared<vector<int>>(vector<int>{1, 2});
+    vector<shared_ptr<vector<int>>> dag = {shared, shared, nullptr, shared};
+    EXPECT_EQ("[[1, 2], [1, 2], nullptr, [1, 2]]", repr(dag));
+    EXPECT_EQ("[[1, 2], <ref#1>, nullptr, <ref#1>]", repr(dag, tracked));
+
+    // references are bracketed like what they refer to
+    auto five = make_shared<int>(5);
+    auto a = make_shared<string>("a");
+    EXPECT_EQ("[5, <ref#1>, 5]",
+              repr(vector<shared_ptr<int>>{five, five, make_shared<int>(5)},
+                   tracked));
+    EXPECT_EQ("[\"a\", <ref#1>]",
+              repr(vector<shared_ptr<string>>{a, a}, tracked));
+    int n = 7;
+    EXPECT_EQ("[7, <ref#1>]", repr(vector<const int*>{&n, &n}, tracked));
+
+    // sharing grows exponentially with depth, the output doesn't
+    auto node = make_shared<Node>();
+    for (int i = 0; i < 40; ++i) {
+        auto parent = make_shared<Node>();
+        parent->children = {node, node};
+        node = parent;
+    }
+    string text = repr(node, tracked);
+    EXPECT_EQ(0u, text.find("[[[["));
+    EXPECT_NE(string::npos, text.find("<ref#40>"));
+
+    auto cyclic = make_shared<Node>();
+    cyclic->children = {cyclic, make_shared<Node>()};
+    EXPECT_EQ("[<cycle>, []]", repr(cyclic, tracked));
+    cyclic->children.clear();
+
+    // a probing pass must not count as the first occurrence
+    Counted words = {"a b"};
+    vector<const Counted*> probed = {&words, &words};
+    EXPECT_EQ("[<a b>, <<ref#1>>]", repr(probed, tracked));
+
+    // an object and its first member are different nodes
+    pair<int, int> p = {1, 2};
+    tuple<const pair<int, int>*, const int*> both{&p, &p.first};
+    EXPECT_EQ("((1, 2), 1)", repr(both, tracked));
+}
+
+TEST(StdlibTests, Parallel)
+{
+    vector<vector<string>> words(100, vector<string>{"a", "b c"});
+    words[42] = {"d"};
+    EXPECT_EQ(repr(words), repr_parallel(words, repr_options(), 4));
+
+    vector<Counted> cs(50, Counted{"x"});
+    cs[7].text = "y z";
+    EXPECT_EQ(repr(cs), repr_parallel(cs, repr_options(), 3));
+    EXPECT_EQ("[]", repr_parallel(vector<int>(), repr_options(), 3));
+
+    repr_options limits;
+    limits.max_elements = 3;
+    limits.tail_elements = 1;
+    limits.max_depth = 2;
+    vector<vector<vector<int>>> nested(10, {{1}, {2, 3}});
+    EXPECT_EQ("[[..., ...], [..., ...], [..., ...], <6 more>, [..., ...]]",
+              repr_parallel(nested, limits, 4));
+    EXPECT_EQ(repr(list<int>{1, 2, 3, 4}, limits),
+              repr_parallel(list<int>{1, 2, 3, 4}, limits, 4));
+
+    // not containers of elements that can be rendered separately
+    EXPECT_EQ("{1: 2}", repr_parallel(map<int, int>{{1, 2}}));
+    EXPECT_EQ("42", repr_parallel(42));
+}
+
+TEST(StdlibTests, ParallelChunks)
+{
+    vector<double> numbers(50000);
+    for (size_t i = 0; i < numbers.size(); ++i)
+        numbers[i] = i / 7.0;
+    EXPECT_EQ(repr(numbers), repr_parallel(numbers, repr_options(), 4));
+
+    // a single element far from the start decides on bracketing for all
+    vector<string> strings(20000, "s");
+    strings[15000] = "s t";
+    EXPECT_EQ(repr(strings), repr_parallel(strings, repr_options(), 3));
+
+    vector<Counted> blanks(5000, Counted{""});
+    blanks[4000].text = "x";
+    EXPECT_EQ(repr(blanks), repr_parallel(blanks, repr_options(), 4));
+
+    repr_options limits;
+    limits.max_elements = 3000;
+    limits.tail_elements = 2500;
+    EXPECT_EQ(repr(numbers, limits), repr_parallel(numbers, limits, 4));
+    limits.tail_elements = 0;
+    EXPECT_EQ(repr(numbers, limits), repr_parallel(numbers, limits, 4));
+}
+
+// single-pass range over an array, without allocating
+struct InputWords {
+    struct iterator {
+        typedef input_iterator_tag iterator_category;
+        typedef const char* value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const char* const* pointer;
+        typedef const char* const& reference;
+
+        const char* const* pos;
+
+        reference operator*() const { return *pos; }
+        iterator& operator++()
+        {
+            ++pos;
+            return *this;
+        }
+        bool operator!=(const iterator& other) const
+        {
+            return pos != other.pos;
+        }
+    };
+
+    const char* const* first;
+    const char* const* last;
+
+    iterator begin() const { return {first}; }
+    iterator end() const { return {last}; }
+};
+
+TEST(StdlibTests, ScratchReuse)
+{
+    const char* words[] = {"a", "b", "c d", "e"};
+    InputWords range = {words, words + 4};
+    string out;
+    out.reserve(100);
+
+    repr_into(out, range);
+    EXPECT_EQ("[<\"a\">, <\"b\">, <\"c d\">, <\"e\">]", out);
+
+    // after the first call the spool comes from the thread's scratch memory
+    size_t before = allocation_count;
+    out.clear();
+    repr_into(out, range);
+    EXPECT_EQ(before, allocation_count.load());
+
+    repr_release_scratch();
+    out.clear();
+    repr_into(out, range);
+    EXPECT_LT(before, allocation_count.load());
+
+    repr_scratch_limit(0);
+    before = allocation_count;
+    out.clear();
+    repr_into(out, range);
+    EXPECT_LT(before, allocation_count.load());
+    repr_scratch_limit(1 << 20);
+}
+
+TEST(StdlibTests, Lazy)
+{
+    counted_renders = 0;
+    vector<Counted> cs = {{"a"}, {"b"}};
+    auto proxy = repr_lazy(cs);
+    EXPECT_EQ(0, counted_renders.load());
+
+    ostringstream out;
+    out << "cs = " << proxy << "!";
+    EXPECT_EQ("cs = [a, b]!", out.str());
+    EXPECT_EQ(4, counted_renders.load()); // probe and output
+
+    repr_options options;
+    options.max_elements = 1;
+    string str = repr_lazy(cs, options);
+    EXPECT_EQ("[a, <1 more>]", str);
+
+    // longer than the chunks streams are written in
+    vector<int> many(1000, 7);
+    ostringstream many_out;
+    many_out << repr_lazy(many);
+    EXPECT_EQ(repr(many), many_out.str());
+}
+
+template <typename T> string captured(const T& x, const repr_options& options)
+{
+    char buf[4096];
+    size_t size = repr_capture(buf, sizeof(buf), x);
+    EXPECT_NE(0u, size);
+
+    string result;
+    EXPECT_TRUE(repr_decode(result, buf, size, options));
+    return result;
+}
+
+#define EXPECT_CAPTURED(x, options)                                            \
+    EXPECT_EQ(repr(x, options), captured(x, options))
+
+TEST(StdlibTests, Capture)
+{
+    repr_options defaults;
+    EXPECT_CAPTURED(42, defaults);
+    EXPECT_CAPTURED(-7L, defaults);
+    EXPECT_CAPTURED(numeric_limits<uint64_t>::max(), defaults);
+    EXPECT_CAPTURED(true, defaults);
+    EXPECT_CAPTURED(0.1f, defaults);
+    EXPECT_CAPTURED(1.0 / 3, defaults);
+    EXPECT_CAPTURED(2.5L, defaults);
+    EXPECT_CAPTURED(string("a \"b\""), defaults);
+    EXPECT_CAPTURED("literal", defaults);
+    EXPECT_CAPTURED('c', defaults);
+    EXPECT_CAPTURED(make_tuple(), defaults);
+    EXPECT_CAPTURED(make_tuple(1, "two", 3.0), defaults);
+    EXPECT_CAPTURED(make_pair(string("k"), vector<int>{1, 2}), defaults);
+
+    map<string, vector<string>> m = {{"a", {"x y", "z"}}, {"b", {}}};
+    EXPECT_CAPTURED(m, defaults);
+
+    unique_ptr<vector<int>> null;
+    auto ptr = make_shared<list<double>>(list<double>{0.5, -1});
+    EXPECT_CAPTURED(null, defaults);
+    EXPECT_CAPTURED(ptr, defaults);
+    EXPECT_CAPTURED(vector<shared_ptr<list<double>>>({ptr, nullptr}), defaults);
+    EXPECT_CAPTURED(make_tuple(nullptr, 1), defaults);
+
+    vector<Counted> cs = {{"a b"}, {"c"}};
+    EXPECT_CAPTURED(cs, defaults);
+    EXPECT_CAPTURED(vector<vector<char>>({{'h', 'i'}, {' '}}), defaults);
+    EXPECT_CAPTURED(forward_list<char>({'a', 'b', 'c'}), defaults);
+
+    IntStream ints;
+    ints.text = "1 2 3";
+    EXPECT_CAPTURED(ints, defaults);
+
+    repr_options limits;
+    limits.max_elements = 2;
+    limits.tail_elements = 1;
+    limits.max_depth = 3;
+    limits.float_precision = 2;
+    EXPECT_CAPTURED(m, limits);
+    EXPECT_CAPTURED(make_tuple(1, 2, 3, 4), limits);
+    EXPECT_CAPTURED(vector<double>({1.234, 2, 3, 4, 5}), limits);
+    EXPECT_CAPTURED(list<int>({1, 2, 3, 4, 5}), limits);
+    EXPECT_CAPTURED(forward_list<int>({1, 2, 3}), limits);
+    EXPECT_CAPTURED(forward_list<char>({'a', 'b', 'c'}), limits);
+    EXPECT_CAPTURED(string("abc"), limits);
+    EXPECT_CAPTURED(vector<vector<vector<vector<int>>>>({{{{1}}}}), limits);
+
+    limits.max_bytes = 8;
+    EXPECT_CAPTURED(m, limits);
+
+    // records that don't fit or are damaged
+    char buf[64];
+    EXPECT_EQ(0u, repr_capture(buf, 8, m));
+
+    size_t size = repr_capture(buf, sizeof(buf), m);
+    string out;
+    EXPECT_FALSE(repr_decode(out, buf, size - 1));
+    EXPECT_FALSE(repr_decode(out, buf, 0));
+    buf[0] = 100;
+    EXPECT_FALSE(repr_decode(out, buf, size));
+    EXPECT_EQ("", out);
+}
+
+TEST(StdlibTests, CharBlocks)
+{
+    string text(1000, 'x');
+    text[500] = ' ';
+    vector<char> block(text.begin(), text.end());
+    list<char> chars(text.begin(), text.end());
+
+    EXPECT_EQ(repr(text), repr(block));
+    EXPECT_EQ(repr(text), repr(chars));
+
+    repr_options options;
+    options.max_elements = 100;
+    EXPECT_EQ("\"" + text.substr(0, 100) + "\"<900 more>",
+              repr(block, options));
+    EXPECT_EQ(repr(block, options), repr(chars, options));
+
+    options.max_elements = 0;
+    options.max_bytes = 70;
+    EXPECT_EQ(repr(text, options), repr(block, options));
+    EXPECT_EQ(repr(text, options), repr(chars, options));
+
+#ifdef REPR_STRING_VIEW
+    string_view view(text.data() + 498, 5);
+    EXPECT_EQ("\"xx xx\"", repr(view));
+    EXPECT_EQ("[<\"xx xx\">, <\"\">]", repr(vector<string_view>{view, {}}));
+#endif
+}
+
+TEST(StdlibTests, Escape)
+{
+    string text = "say \"hi\"\\\n\t\x01" "7\x7f";
+    text += string(40, 'x') + "\x1b";
+
+    repr_options options;
+    EXPECT_EQ("\"" + text + "\"", repr(text, options));
+
+    options.escape = repr_escape::c;
+    string c = "\"say \\\"hi\\\"\\\\\\n\\t\\0017\\177" + string(40, 'x') +
+               "\\033\"";
+    EXPECT_EQ(c, repr(text, options));
+    EXPECT_EQ(c, repr(vector<char>(text.begin(), text.end()), options));
+    EXPECT_EQ(c, repr(list<char>(text.begin(), text.end()), options));
+    EXPECT_EQ("\"\\\"\"", repr('"', options));
+    EXPECT_EQ("[\"a\\nb\", \"\\\"\"]",
+              repr(vector<string>{"a\nb", "\""}, options));
+
+    options.escape = repr_escape::json;
+    string json = "\"say \\\"hi\\\"\\\\\\n\\t\\u00017\x7f" + string(40, 'x') +
+                  "\\u001b\"";
+    EXPECT_EQ(json, repr(text, options));
+    EXPECT_EQ(json,
+              repr(forward_list<char>(text.begin(), text.end()), options));
+
+    // clean strings of all lengths go through the vectorized scan
+    for (size_t n = 0; n < 100; ++n) {
+        string clean(n, 'a');
+        EXPECT_EQ("\"" + clean + "\"", repr(clean, options));
+        clean += '"';
+        EXPECT_EQ("\"" + clean.substr(0, n) + "\\\"\"", repr(clean, options));
+    }
+}
+
+TEST(StdlibTests, Bytes)
+{
+    vector<uint8_t> bytes = {0x48, 0x69, 0x0a, 0xff, 0x00};
+    array<unsigned char, 3> arr = {{1, 2, 0xab}};
+
+    EXPECT_EQ("x\"48690aff00\"", repr(bytes));
+    EXPECT_EQ("x\"0102ab\"", repr(arr));
+    EXPECT_EQ("x\"\"", repr(vector<uint8_t>()));
+    EXPECT_EQ("[x\"0102ab\", x\"\"]",
+              repr(vector<vector<uint8_t>>{{1, 2, 0xab}, {}}));
+    EXPECT_EQ("x\"48690aff00\"",
+              repr(list<uint8_t>(bytes.begin(), bytes.end())));
+
+    repr_options options;
+    options.max_elements = 2;
+    EXPECT_EQ("x\"4869\"<3 more>", repr(bytes, options));
+    EXPECT_EQ("x\"4869\"...",
+              repr(forward_list<uint8_t>(bytes.begin(), bytes.end()), options));
+
+    // every byte value, through all the vectorized and scalar paths
+    vector<uint8_t> all(1000);
+    string expected;
+    for (size_t i = 0; i < all.size(); ++i) {
+        all[i] = static_cast<uint8_t>(i * 7);
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", all[i]);
+        expected += hex;
+    }
+    EXPECT_EQ("x\"" + expected + "\"", repr(all));
+    EXPECT_EQ(repr(all), repr(list<uint8_t>(all.begin(), all.end())));
+
+    options.max_elements = 0;
+    options.max_bytes = 10;
+    EXPECT_EQ("x\"" + expected.substr(0, 5) + "...", repr(all, options));
+
+    repr_options dump;
+    dump.byte_format = repr_byte_format::dump;
+    string text = "Hello, world!\n\x01 and more";
+    vector<uint8_t> buffer(text.begin(), text.end());
+    EXPECT_EQ("00000000  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 01 20  "
+              "|Hello, world!.. |\n"
+              "00000010  61 6e 64 20 6d 6f 72 65                           "
+              "|and more|",
+              repr(buffer, dump));
+    EXPECT_EQ(repr(buffer, dump),
+              repr(list<uint8_t>(buffer.begin(), buffer.end()), dump));
+    EXPECT_EQ("x\"\"", repr(vector<uint8_t>(), dump));
+
+    dump.max_elements = 4;
+    EXPECT_EQ("00000000  48 65 6c 6c                                       "
+              "|Hell|\n<20 more>",
+              repr(buffer, dump));
+
+    char buf[4096];
+    size_t size = repr_capture(buf, sizeof(buf), buffer);
+    string decoded;
+    EXPECT_TRUE(repr_decode(decoded, buf, size, dump));
+    EXPECT_EQ(repr(buffer, dump), decoded);
+}
+
+TEST(StdlibTests, Json)
+{
+    repr_options json;
+    json.json = true;
+
+    EXPECT_EQ("[1, 2, 3]", repr(vector<int>{1, 2, 3}, json));
+    EXPECT_EQ("[1, \"two words\", 3.5, true]",
+              repr(make_tuple(1, "two words", 3.5, true), json));
+    EXPECT_EQ("{\"a\": [1], \"b c\": []}",
+              repr(map<string, vector<int>>{{"a", {1}}, {"b c", {}}}, json));
+    EXPECT_EQ("[[1, \"one\"], [2, \"two\"]]",
+              repr(map<int, string>{{1, "one"}, {2, "two"}}, json));
+    EXPECT_EQ("[null, 5]",
+              repr(vector<shared_ptr<int>>{nullptr, make_shared<int>(5)},
+                   json));
+    EXPECT_EQ("null", repr(nullptr, json));
+    EXPECT_EQ("[null, 1]", repr(make_tuple(nullptr, 1), json));
+    EXPECT_EQ("(nullptr, 1)", repr(make_tuple(nullptr, 1)));
+    EXPECT_EQ("\"a\\\"b\\n\"", repr(string("a\"b\n"), json));
+    EXPECT_EQ("[\"nan\", \"-inf\", 0.5]",
+              repr(vector<double>{NAN, -INFINITY, 0.5}, json));
+    EXPECT_EQ("\"0aff\"", repr(vector<uint8_t>{0x0a, 0xff}, json));
+
+    // values without a JSON form of their own are strings of their text
+    Counted counted = {"x \"y\""};
+    EXPECT_EQ("[\"x \\\"y\\\"\", \"x \\\"y\\\"\"]",
+              repr(vector<Counted>{counted, counted}, json));
+
+    json.max_elements = 2;
+    EXPECT_EQ("[1, 2, \"<3 more>\"]", repr(vector<int>{1, 2, 3, 4, 5}, json));
+    EXPECT_EQ("[1, 2, \"<1 more>\"]", repr(make_tuple(1, 2, 3), json));
+    EXPECT_EQ("\"ab<1 more>\"", repr(string("abc"), json));
+    EXPECT_EQ("{\"a\": 1, \"b\": 2, \"<1 more>\": null}",
+              repr(map<string, int>{{"a", 1}, {"b", 2}, {"c", 3}}, json));
+
+    json.max_elements = 0;
+    json.max_depth = 1;
+    EXPECT_EQ("[\"...\"]", repr(vector<vector<vector<int>>>{{{1}}}, json));
+
+    json.max_depth = 0;
+    json.track_pointers = true;
+    auto shared = make_shared<int>(1);
+    EXPECT_EQ("[1, \"<ref#1>\"]",
+              repr(vector<shared_ptr<int>>{shared, shared}, json));
+
+    // captured values decode to the same JSON
+    json.track_pointers = false;
+    map<string, vector<Counted>> m = {{"k", {counted}}};
+    char buf[256];
+    size_t size = repr_capture(buf, sizeof(buf), m);
+    string decoded;
+    EXPECT_TRUE(repr_decode(decoded, buf, size, json));
+    EXPECT_EQ(repr(m, json), decoded);
+
+    vector<int> many(5000, 7);
+    EXPECT_EQ(repr(many, json), repr_parallel(many, json, 4));
+}
+
+TEST(StdlibTests, LineWidth)
+{
+    repr_options options;
+    options.line_width = 20;
+
+    map<string, vector<int>> m = {{"short", {1, 2}},
+                                  {"long", {100000, 200000, 300000}}};
+    EXPECT_EQ("{\n"
+              "    \"long\": [\n"
+              "        100000,\n"
+              "        200000,\n"
+              "        300000\n"
+              "    ],\n"
+              "    \"short\": [1, 2]\n"
+              "}",
+              repr(m, options));
+
+    // a group ending right at the width only fits without the comma after it
+    m = {{"key", {1, 2, 3}}, {"zzz", {4, 5, 6}}};
+    EXPECT_EQ("{\n"
+              "    \"key\": [\n"
+              "        1,\n"
+              "        2,\n"
+              "        3\n"
+              "    ],\n"
+              "    \"zzz\": [4, 5, 6]\n"
+              "}",
+              repr(m, options));
+
+    // whatever fits stays on one line
+    EXPECT_EQ("[1, 2, 3]", repr(vector<int>{1, 2, 3}, options));
+    EXPECT_EQ("[]", repr(vector<int>(), options));
+    EXPECT_EQ("()", repr(make_tuple(), options));
+
+    options.indent_width = 2;
+    EXPECT_EQ("(\n"
+              "  \"a long string\",\n"
+              "  [<1 2>, <3>],\n"
+              "  {}\n"
+              ")",
+              repr(make_tuple("a long string",
+                              vector<Counted>{{"1 2"}, {"3"}},
+                              map<int, int>()),
+                   options));
+
+    // the byte budget includes line breaks and indentation
+    options.max_bytes = 12;
+    EXPECT_EQ("(\n  \"a lo...",
+              repr(make_tuple("a long string", 12345), options));
+
+    // text is written out as the layout is decided, not all at the end
+    options.max_bytes = 0;
+    options.indent_width = 4;
+    options.line_width = 40;
+    vector<vector<int>> big(20000, vector<int>{1, 2, 3});
+    string text = repr(big, options);
+    EXPECT_EQ(string("[\n    [1, 2, 3],\n"), text.substr(0, 17));
+    EXPECT_EQ(20002u, count(text.begin(), text.end(), '\n') + 1);
+
+    options.json = true;
+    options.line_width = 10;
+    EXPECT_EQ("[\n    [1, \"x\"],\n    [2, \"y\"]\n]",
+              repr(map<int, string>{{1, "x"}, {2, "y"}}, options));
+
+    // once the scratch buffers have grown, laying out doesn't allocate
+    options = repr_options();
+    options.line_width = 20;
+    char buf[256];
+    repr_into(buf, sizeof(buf), m, options);
+    size_t before = allocation_count;
+    auto res = repr_into(buf, sizeof(buf), m, options);
+    EXPECT_EQ(before, allocation_count.load());
+    EXPECT_EQ(repr(m, options), string(buf, res.size));
+}
+
+namespace geometry
+{
+struct Point {
+    int x, y;
+};
+
+void repr_append(repr_writer& out, const Point& p)
+{
+    out.write("Point(", 6);
+    repr_append_nested(out, p.x);
+    out.write(", ", 2);
+    repr_append_nested(out, p.y);
+    out.put(')');
+}
+
+// would otherwise be taken for a container
+struct Polygon {
+    vector<Point> points;
+
+    vector<Point>::const_iterator begin() const { return points.begin(); }
+    vector<Point>::const_iterator end() const { return points.end(); }
+};
+
+void repr_append(repr_writer& out, const Polygon& poly)
+{
+    out.write("Polygon");
+    repr_append_nested(out, poly.points);
+}
+} // namespace geometry
+
+TEST(StdlibTests, CustomRepr)
+{
+    geometry::Point p = {1, -2};
+    geometry::Polygon poly = {{{0, 0}, {3, 4}}};
+
+    EXPECT_EQ("Point(1, -2)", repr(p));
+    EXPECT_EQ("[<Point(1, -2)>, <Point(1, -2)>]",
+              repr(vector<geometry::Point>{p, p}));
+    EXPECT_EQ("Polygon[<Point(0, 0)>, <Point(3, 4)>]", repr(poly));
+    EXPECT_EQ("Point(1, -2)", repr(&p));
+
+    repr_options options;
+    options.max_bytes = 10;
+    EXPECT_EQ("Polygon...", repr(poly, options));
+
+    options.max_bytes = 0;
+    options.line_width = 20;
+    EXPECT_EQ("Polygon[\n    <Point(0, 0)>,\n    <Point(3, 4)>\n]",
+              repr(poly, options));
+
+    options.line_width = 0;
+    options.json = true;
+    EXPECT_EQ("[\"Point(1, -2)\"]", repr(vector<geometry::Point>{p}, options));
+}
+
+TEST(StdlibTests, RenderCache)
+{
+    map<string, vector<int>> config = {{"a", {1, 2}}, {"b", {3}}};
+    repr_render_cache cache;
+    repr_options options;
+    options.render_cache = &cache;
+
+    EXPECT_EQ("{\"a\": [1, 2], \"b\": [3]}", repr(repr_cached(config)));
+    EXPECT_EQ("{\"a\": [1, 2], \"b\": [3]}",
+              repr(repr_cached(config, 1), options));
+    EXPECT_EQ(1u, cache.misses());
+
+    // the text is reused until the version changes
+    config["c"] = {};
+    EXPECT_EQ("{\"a\": [1, 2], \"b\": [3]}",
+              repr(repr_cached(config, 1), options));
+    EXPECT_EQ(1u, cache.hits());
+    EXPECT_EQ("{\"a\": [1, 2], \"b\": [3], \"c\": []}",
+              repr(repr_cached(config, 2), options));
+    EXPECT_EQ(1u, cache.size());
+
+    // nested, bracketed like the value itself
+    string s = "x y";
+    auto pair = make_pair(repr_cached(s), repr_cached(config, 2));
+    EXPECT_EQ("(\"x y\", {\"a\": [1, 2], \"b\": [3], \"c\": []})",
+              repr(pair, options));
+    EXPECT_EQ(2u, cache.hits());
+    EXPECT_EQ("[<\"x y\">]",
+              repr(vector<decltype(repr_cached(s))>{repr_cached(s)}, options));
+
+    // other options render the value again
+    options.max_elements = 1;
+    EXPECT_EQ("{\"a\": [1, <1 more>], <2 more>}",
+              repr(repr_cached(config, 2), options));
+    options.max_elements = 0;
+    options.max_bytes = 10;
+    EXPECT_EQ("{\"a\": [...", repr(repr_cached(config, 2), options));
+    options.max_bytes = 0;
+
+    cache.invalidate(config);
+    EXPECT_EQ(1u, cache.size());
+    cache.invalidate();
+    EXPECT_EQ(0u, cache.bytes());
+
+    // the least recently used text is dropped
+    repr_render_cache small(60);
+    options.render_cache = &small;
+    vector<int> xs(10, 1), ys(10, 2), zs(10, 3);
+    repr(repr_cached(xs), options);
+    repr(repr_cached(ys), options);
+    repr(repr_cached(xs), options);
+    repr(repr_cached(zs), options);
+    EXPECT_EQ(2u, small.size());
+    EXPECT_EQ(60u, small.bytes());
+    repr(repr_cached(xs), options);
+    EXPECT_EQ(2u, small.hits());
+    repr(repr_cached(ys), options);
+    EXPECT_EQ(2u, small.hits());
+}
+
+// read back everything written to `file`
+static string read_all(std::FILE* file)
+{
+    std::rewind(file);
+    string result;
+    char buf[4096];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), file)) > 0;)
+        result.append(buf, n);
+    return result;
+}
+
+TEST(StdlibTests, FileOutput)
+{
+    // small elements are gathered into chunks, the long string goes as it is
+    vector<int> xs(100000, 42);
+    auto x = make_tuple(string(200000, 'a'), xs, string(10, 'b'));
+
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    EXPECT_TRUE(repr_to_fd(fileno(file), x));
+    EXPECT_EQ(repr(x), read_all(file));
+    std::fclose(file);
+
+    repr_options options;
+    options.max_bytes = 12;
+    file = std::tmpfile();
+    EXPECT_TRUE(repr_to_fd(fileno(file), xs, options));
+    EXPECT_EQ("[42, 42, ...", read_all(file));
+    std::fclose(file);
+
+    string path = testing::TempDir() + "repr_to_file.txt";
+    EXPECT_TRUE(repr_to_file(path, map<string, int>{{"a", 1}}));
+    file = std::fopen(path.c_str(), "r");
+    ASSERT_NE(nullptr, file);
+    EXPECT_EQ("{\"a\": 1}", read_all(file));
+    std::fclose(file);
+    std::remove(path.c_str());
+
+    EXPECT_FALSE(repr_to_fd(-1, xs));
+    EXPECT_FALSE(repr_to_file("/nonexistent/repr.txt", xs));
+}